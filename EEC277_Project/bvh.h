@@ -0,0 +1,268 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "threadpool.h"
+
+// BVH build options
+const int BVH_BINS      = 16;   // Number of bins per axis for the binned SAH
+const int BVH_MAX_LEAF  = 4;    // Leaves never hold more spheres than this (count is packed in 3 bits)
+const float BVH_TRAVERSAL_COST = 1.0f;  // Cost of one node visit relative to one ray-sphere test
+const int BVH_REFIT_CHUNK = 1024;       // Nodes per task of a parallel refit, smaller levels are refitted on the calling thread
+
+// One node in depth-first order. The first child of an interior node always follows it directly,
+// so the shader can walk the tree without a stack: go to node + 1 on a hit, jump to escape on a miss.
+struct BVHNode {
+    glm::vec3 bmin;
+    glm::vec3 bmax;
+    GLint escape;   // Next node when this subtree is skipped or finished, -1 ends the traversal
+    GLint first;    // First entry in Indices (leaves only)
+    GLint count;    // Number of spheres in the leaf, 0 for interior nodes
+};
+
+// Bounding volume hierarchy over spheres, built on the CPU with a binned surface area heuristic
+class BVH
+{
+public:
+    std::vector<BVHNode> Nodes;
+    std::vector<GLint> Indices;     // Sphere indices, leaves reference contiguous ranges
+
+    // Builds the tree from scratch
+    void Build(const std::vector<Sphere>& spheres)
+    {
+        this->Nodes.clear();
+        this->Indices.resize(spheres.size());
+        this->centroids.resize(spheres.size());
+        this->bounds.resize(spheres.size());
+        for (size_t i = 0; i < spheres.size(); i++) {
+            glm::vec3 c = glm::vec3(spheres[i].position_r.x, spheres[i].position_r.y, spheres[i].position_r.z);
+            glm::vec3 r = glm::vec3(spheres[i].position_r.w);
+            this->Indices[i] = (GLint)i;
+            this->centroids[i] = c;
+            this->bounds[i].bmin = c - r;
+            this->bounds[i].bmax = c + r;
+        }
+        if (spheres.empty())
+            return;
+        this->Nodes.reserve(2 * spheres.size() / BVH_MAX_LEAF + 1);
+        this->buildNode(0, (int)spheres.size());
+
+        // The escape of the last subtree on the right spine points past the end
+        for (size_t i = 0; i < this->Nodes.size(); i++)
+            if (this->Nodes[i].escape >= (GLint)this->Nodes.size())
+                this->Nodes[i].escape = -1;
+
+        // Group the nodes for Refit(). The children of interior node i are i + 1 and the node its first child escapes to.
+        this->leaves.clear();
+        this->levels.clear();
+        std::vector<int> depth(this->Nodes.size(), 0);
+        for (size_t i = 0; i < this->Nodes.size(); i++) {
+            if (this->Nodes[i].count > 0) {
+                this->leaves.push_back((int)i);
+                continue;
+            }
+            int d = depth[i];
+            if ((int)this->levels.size() <= d)
+                this->levels.resize(d + 1);
+            this->levels[d].push_back((int)i);
+            depth[i + 1] = depth[this->Nodes[i + 1].escape] = d + 1;
+        }
+    }
+
+    // Recomputes the bounds of every node for spheres that moved, keeping the tree and Indices as they are.
+    // Leaves are refitted in parallel, then the interior nodes one depth level at a time from the bottom up.
+    // Spheres drifting away from their old neighbours make the tree worse, which shows in Cost().
+    void Refit(const std::vector<Sphere>& spheres, ThreadPool& pool)
+    {
+        forEach(pool, this->leaves, [&](int index) {
+            BVHNode& n = this->Nodes[index];
+            AABB box;
+            for (int i = n.first; i < n.first + n.count; i++) {
+                const glm::vec4& p = spheres[this->Indices[i]].position_r;
+                box.Grow(glm::vec3(p) - glm::vec3(p.w));
+                box.Grow(glm::vec3(p) + glm::vec3(p.w));
+            }
+            n.bmin = box.bmin;
+            n.bmax = box.bmax;
+        });
+        for (int level = (int)this->levels.size() - 1; level >= 0; level--)
+            forEach(pool, this->levels[level], [&](int index) {
+                const BVHNode& left = this->Nodes[index + 1];
+                const BVHNode& right = this->Nodes[left.escape];
+                this->Nodes[index].bmin = glm::min(left.bmin, right.bmin);
+                this->Nodes[index].bmax = glm::max(left.bmax, right.bmax);
+            });
+    }
+
+    // Surface area heuristic cost of the whole tree, normalized by the root area
+    float Cost() const
+    {
+        if (this->Nodes.empty())
+            return 0.0f;
+        float cost = 0.0f;
+        for (size_t i = 0; i < this->Nodes.size(); i++) {
+            AABB b;
+            b.bmin = this->Nodes[i].bmin;
+            b.bmax = this->Nodes[i].bmax;
+            cost += b.Area() * (this->Nodes[i].count > 0 ? (float)this->Nodes[i].count : BVH_TRAVERSAL_COST);
+        }
+        AABB root;
+        root.bmin = this->Nodes[0].bmin;
+        root.bmax = this->Nodes[0].bmax;
+        return root.Area() > 0.0f ? cost / root.Area() : cost;
+    }
+
+    // Packs the nodes into 2 integer texels each for an isamplerBuffer:
+    // (floatBitsToInt(bmin), escape), (floatBitsToInt(bmax), first << 3 | count)
+    std::vector<GLint> Flatten() const
+    {
+        std::vector<GLint> texels(this->Nodes.size() * 8);
+        for (size_t i = 0; i < this->Nodes.size(); i++) {
+            const BVHNode& n = this->Nodes[i];
+            GLint* t = &texels[i * 8];
+            memcpy(&t[0], &n.bmin.x, sizeof(GLfloat));
+            memcpy(&t[1], &n.bmin.y, sizeof(GLfloat));
+            memcpy(&t[2], &n.bmin.z, sizeof(GLfloat));
+            t[3] = n.escape;
+            memcpy(&t[4], &n.bmax.x, sizeof(GLfloat));
+            memcpy(&t[5], &n.bmax.y, sizeof(GLfloat));
+            memcpy(&t[6], &n.bmax.z, sizeof(GLfloat));
+            t[7] = (n.first << 3) | n.count;
+        }
+        return texels;
+    }
+
+private:
+    std::vector<glm::vec3> centroids;
+    std::vector<AABB> bounds;
+    std::vector<int> leaves;                // Leaf nodes, refitted first
+    std::vector<std::vector<int> > levels;  // Interior nodes by depth, refitted from the deepest level up
+
+    // Calls f(node) for every node in the list, spread over the pool in chunks of BVH_REFIT_CHUNK
+    template <typename F>
+    static void forEach(ThreadPool& pool, const std::vector<int>& nodes, const F& f)
+    {
+        int n = (int)nodes.size();
+        if (n <= BVH_REFIT_CHUNK) {
+            for (int i = 0; i < n; i++)
+                f(nodes[i]);
+            return;
+        }
+        pool.Run((n + BVH_REFIT_CHUNK - 1) / BVH_REFIT_CHUNK, [&](int task, int /*worker*/) {
+            int end = std::min(n, (task + 1) * BVH_REFIT_CHUNK);
+            for (int i = task * BVH_REFIT_CHUNK; i < end; i++)
+                f(nodes[i]);
+        });
+    }
+
+    // Recursively builds the subtree over Indices[begin, end) and returns its node index
+    int buildNode(int begin, int end)
+    {
+        int index = (int)this->Nodes.size();
+        this->Nodes.push_back(BVHNode());
+
+        AABB box, centroidBox;
+        for (int i = begin; i < end; i++) {
+            box.Grow(this->bounds[this->Indices[i]]);
+            centroidBox.Grow(this->centroids[this->Indices[i]]);
+        }
+        this->Nodes[index].bmin = box.bmin;
+        this->Nodes[index].bmax = box.bmax;
+        this->Nodes[index].first = begin;
+        this->Nodes[index].count = 0;
+
+        int n = end - begin;
+        int mid = this->findSplit(begin, end, box, centroidBox);
+        if (mid < 0) { // Cheaper as a leaf
+            this->Nodes[index].count = n;
+            this->Nodes[index].escape = (GLint)this->Nodes.size();
+            return index;
+        }
+
+        this->buildNode(begin, mid);
+        this->buildNode(mid, end);
+        this->Nodes[index].escape = (GLint)this->Nodes.size();
+        return index;
+    }
+
+    // Partitions Indices[begin, end) at the best SAH split and returns the split position, or -1 to make a leaf
+    int findSplit(int begin, int end, const AABB& box, const AABB& centroidBox)
+    {
+        int n = end - begin;
+        if (n <= 1)
+            return -1;
+
+        glm::vec3 extent = centroidBox.bmax - centroidBox.bmin;
+        float bestCost = 1e30f;
+        int bestAxis = -1, bestBin = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (extent[axis] <= 0.0f)
+                continue;
+            AABB binBox[BVH_BINS];
+            int binCount[BVH_BINS] = {0};
+            float scale = BVH_BINS / extent[axis];
+            for (int i = begin; i < end; i++) {
+                int b = std::min(BVH_BINS - 1, (int)((this->centroids[this->Indices[i]][axis] - centroidBox.bmin[axis]) * scale));
+                binCount[b]++;
+                binBox[b].Grow(this->bounds[this->Indices[i]]);
+            }
+
+            // Sweep from the right to get the cost of every right side, then from the left
+            float rightArea[BVH_BINS];
+            int rightCount[BVH_BINS];
+            AABB acc;
+            int count = 0;
+            for (int b = BVH_BINS - 1; b > 0; b--) {
+                acc.Grow(binBox[b]);
+                count += binCount[b];
+                rightArea[b] = acc.Area();
+                rightCount[b] = count;
+            }
+            acc = AABB();
+            count = 0;
+            for (int b = 0; b < BVH_BINS - 1; b++) {
+                acc.Grow(binBox[b]);
+                count += binCount[b];
+                if (count == 0 || rightCount[b + 1] == 0)
+                    continue;
+                float cost = acc.Area() * count + rightArea[b + 1] * rightCount[b + 1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+
+        float leafCost = (float)n;
+        float splitCost = BVH_TRAVERSAL_COST + (box.Area() > 0.0f ? bestCost / box.Area() : 0.0f);
+        if (n <= BVH_MAX_LEAF && (bestAxis < 0 || leafCost <= splitCost))
+            return -1;
+
+        int mid;
+        if (bestAxis >= 0) {
+            float scale = BVH_BINS / extent[bestAxis];
+            float minC = centroidBox.bmin[bestAxis];
+            const std::vector<glm::vec3>& c = this->centroids;
+            GLint* split = std::partition(&this->Indices[begin], &this->Indices[0] + end, [&](GLint i) {
+                return std::min(BVH_BINS - 1, (int)((c[i][bestAxis] - minC) * scale)) <= bestBin;
+            });
+            mid = (int)(split - &this->Indices[0]);
+        } else {
+            mid = begin;
+        }
+
+        // All centroids coincide (or binning failed), fall back to splitting the range in half
+        if (mid == begin || mid == end)
+            mid = begin + n / 2;
+        return mid;
+    }
+};
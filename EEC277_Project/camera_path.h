@@ -0,0 +1,91 @@
+#pragma once
+
+// Std. Includes
+#include <stdio.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// GL Includes
+#include <glm/glm.hpp>
+
+// Camera and light keyframes read from a text file, one per line: "time x y z yaw lx ly lz".
+// Time is in seconds and must increase, yaw turns the view around the y axis in degrees like moving the mouse
+// sideways, positive to the right, and lx ly lz is the light direction. Between keyframes every value is
+// interpolated linearly.
+// Empty lines and lines starting with # are skipped.
+class CameraPath
+{
+public:
+    struct Keyframe {
+        float time;
+        glm::vec3 position;
+        float yaw;
+        glm::vec3 light;
+    };
+    std::vector<Keyframe> Keyframes;
+
+    // Prints the reason and returns false if the file cannot be used
+    bool Load(const char* path)
+    {
+        this->Keyframes.clear();
+        std::ifstream in(path);
+        if (!in) {
+            fprintf(stderr, "Cannot open camera path %s\n", path);
+            return false;
+        }
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(in, line)) {
+            lineNumber++;
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#')
+                continue;
+            std::istringstream fields(line);
+            Keyframe k;
+            if (!(fields >> k.time >> k.position.x >> k.position.y >> k.position.z >> k.yaw >> k.light.x >> k.light.y >> k.light.z)) {
+                fprintf(stderr, "%s:%d: expected time x y z yaw lx ly lz\n", path, lineNumber);
+                return false;
+            }
+            if (!this->Keyframes.empty() && k.time <= this->Keyframes.back().time) {
+                fprintf(stderr, "%s:%d: keyframe times must increase\n", path, lineNumber);
+                return false;
+            }
+            this->Keyframes.push_back(k);
+        }
+        if (this->Keyframes.empty()) {
+            fprintf(stderr, "%s has no keyframes\n", path);
+            return false;
+        }
+        return true;
+    }
+
+    // Seconds from the first to the last keyframe
+    float Duration() const
+    {
+        return this->Keyframes.back().time - this->Keyframes.front().time;
+    }
+
+    // Camera and light at a time since the first keyframe, held at the ends
+    Keyframe Sample(float t) const
+    {
+        t += this->Keyframes.front().time;
+        size_t next = 0;
+        while (next < this->Keyframes.size() && this->Keyframes[next].time < t)
+            next++;
+        if (next == 0)
+            return this->Keyframes.front();
+        if (next == this->Keyframes.size())
+            return this->Keyframes.back();
+        const Keyframe& a = this->Keyframes[next - 1];
+        const Keyframe& b = this->Keyframes[next];
+        float f = (t - a.time) / (b.time - a.time);
+        Keyframe k;
+        k.time = t;
+        k.position = glm::mix(a.position, b.position, f);
+        k.yaw = glm::mix(a.yaw, b.yaw, f);
+        k.light = glm::mix(a.light, b.light, f);
+        return k;
+    }
+};
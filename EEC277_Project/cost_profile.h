@@ -0,0 +1,98 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "image_writer.h"
+
+// Channels of the RGBA32UI cost texture written by the first pass when it is compiled with PROFILE
+enum Cost_Channel {
+    COST_RAYS,          // Rays of every type traced by the pixel
+    COST_SPHERE_TESTS,  // Ray-sphere intersection tests, closest hit and shadow queries together
+    COST_DEPTH,         // Bounces of the path
+    COST_CLOCK,         // Shader clock cycles of the invocation, 0 without ARB_shader_clock
+    COST_CHANNELS
+};
+const char* const costNames[] = {"Rays", "Sphere Tests", "Depth", "Clock"};
+
+const GLuint PROFILE_TILE_SIZE = 32;    // Pixels along the side of a tile in the cost summary
+
+// Per-pixel cost of the last frame, read back from the cost texture
+class CostProfile
+{
+public:
+    // Sums of every channel over a square of the image, clipped at its right and top edges
+    struct Tile {
+        GLuint X, Y, Width, Height;
+        double Sum[COST_CHANNELS];
+    };
+
+    GLuint Width, Height;
+    std::vector<GLuint> Texels;     // Four channels per pixel, bottom row first
+
+    CostProfile() : Width(0), Height(0) {}
+
+    void Read(GLuint texture, GLuint width, GLuint height)
+    {
+        this->Width = width;
+        this->Height = height;
+        this->Texels.resize((size_t)4 * width * height);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, &this->Texels[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    double Total(int channel) const
+    {
+        double total = 0.0;
+        for (size_t i = channel; i < this->Texels.size(); i += 4)
+            total += this->Texels[i];
+        return total;
+    }
+
+    // Tiles of PROFILE_TILE_SIZE pixels, row by row from the bottom left corner
+    std::vector<Tile> Tiles() const
+    {
+        std::vector<Tile> tiles;
+        for (GLuint y = 0; y < this->Height; y += PROFILE_TILE_SIZE)
+            for (GLuint x = 0; x < this->Width; x += PROFILE_TILE_SIZE) {
+                Tile t = {x, y, std::min(PROFILE_TILE_SIZE, this->Width - x), std::min(PROFILE_TILE_SIZE, this->Height - y), {0.0}};
+                for (GLuint py = y; py < y + t.Height; py++)
+                    for (GLuint px = x; px < x + t.Width; px++)
+                        for (int c = 0; c < COST_CHANNELS; c++)
+                            t.Sum[c] += this->Texels[4 * ((size_t)py * this->Width + px) + c];
+                tiles.push_back(t);
+            }
+        return tiles;
+    }
+
+    // Writes a channel as a black, red, yellow, white heatmap. The scale ends at the 99th percentile of the channel,
+    // so a few outliers, like clock cycles of an invocation that was preempted, do not wash out the rest of the image.
+    bool WriteHeatmap(int channel, const std::string& path) const
+    {
+        size_t pixels = (size_t)this->Width * this->Height;
+        std::vector<GLuint> values(pixels);
+        for (size_t i = 0; i < pixels; i++)
+            values[i] = this->Texels[4 * i + channel];
+        std::vector<GLuint> sorted(values);
+        size_t rank = std::min(pixels - 1, pixels * 99 / 100);
+        std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+        double scale = std::max(sorted[rank], 1u);
+
+        std::vector<unsigned char> rgba(4 * pixels);
+        for (size_t i = 0; i < pixels; i++) {
+            float t = std::min(1.0f, float(values[i] / scale));
+            rgba[4 * i] = (unsigned char)(255.0f * std::min(1.0f, 3.0f * t));
+            rgba[4 * i + 1] = (unsigned char)(255.0f * std::min(1.0f, std::max(0.0f, 3.0f * t - 1.0f)));
+            rgba[4 * i + 2] = (unsigned char)(255.0f * std::max(0.0f, 3.0f * t - 2.0f));
+            rgba[4 * i + 3] = 255;
+        }
+        return writePNG(path.c_str(), &rgba[0], this->Width, this->Height);
+    }
+};
@@ -0,0 +1,461 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// GL Includes
+#include <glm/glm.hpp>
+
+#include "scene.h"
+#include "bvh.h"
+#include "grid.h"
+#include "threadpool.h"
+
+// Same constants as first_pass.frag
+const float RT_EPSILON   = 1e-3f;
+const float RT_EXPOSURE  = 1e-2f;
+const float RT_GAMMA     = 2.2f;
+const float RT_INTENSITY = 100.0f;
+const float RT_MAX_LEN   = 2147483647.0f;
+
+// CPU version of first_pass.frag. radiance(), trace() and both intersect() follow the shader line by line,
+// including refraction, the shadow rays and the plane, so it can run the benchmarks without a GPU and serves
+// as a reference that does not depend on driver quirks. The screen is split into tiles rendered on a thread pool.
+class CPURenderer
+{
+public:
+    std::vector<unsigned char> Image;   // RGB8, bottom row first like the image texture
+    GLuint Totals[4];                   // Rays in the last frame, indexed by Ray_Type
+
+    CPURenderer() : spheres(nullptr), bvh(nullptr), grid(nullptr)
+    {
+        this->Totals[0] = this->Totals[1] = this->Totals[2] = this->Totals[3] = 0;
+    }
+
+    // The scene is only referenced, it must stay alive while rendering
+    void SetScene(const std::vector<Sphere>* spheres, const BVH* bvh, const UniformGrid* grid)
+    {
+        this->spheres = spheres;
+        this->bvh = bvh;
+        this->grid = grid;
+    }
+
+    // Renders one frame with every thread of the pool
+    void Render(const RenderSettings& settings, ThreadPool& pool)
+    {
+        this->settings = settings;
+        this->light = Light(glm::vec3(1.0f) * RT_INTENSITY, glm::normalize(settings.lightDirection));
+        this->Image.resize(settings.width * settings.height * 3);
+
+        int tilesX = (settings.width + TILE_SIZE - 1) / TILE_SIZE;
+        int tilesY = (settings.height + TILE_SIZE - 1) / TILE_SIZE;
+        std::vector<WorkerCount> counts(pool.Size());
+        pool.Run(tilesX * tilesY, [&](int tile, int worker) {
+            int x0 = (tile % tilesX) * TILE_SIZE, y0 = (tile / tilesX) * TILE_SIZE;
+            int x1 = std::min(x0 + TILE_SIZE, settings.width), y1 = std::min(y0 + TILE_SIZE, settings.height);
+            for (int y = y0; y < y1; y++)
+                for (int x = x0; x < x1; x++)
+                    this->shade(x, y, counts[worker].rays);
+        });
+
+        for (int t = 0; t < 4; t++) {
+            this->Totals[t] = 0;
+            for (size_t w = 0; w < counts.size(); w++)
+                this->Totals[t] += counts[w].rays[t];
+        }
+    }
+
+    // All rays of every type
+    GLuint Total() const
+    {
+        return this->Totals[PRIMARY_RAY] + this->Totals[REFLECTION_RAY] + this->Totals[REFRACTION_RAY] + this->Totals[SHADOW_RAY];
+    }
+
+private:
+    static const int TILE_SIZE = 16;   // Pixels along one side of a tile, one tile per task
+
+    struct Ray {
+        glm::vec3 origin;
+        glm::vec3 direction;
+        Ray(glm::vec3 origin, glm::vec3 direction) : origin(origin), direction(direction) {}
+    };
+
+    struct Light {
+        glm::vec3 color;
+        glm::vec3 direction;
+        Light() {}
+        Light(glm::vec3 color, glm::vec3 direction) : color(color), direction(direction) {}
+    };
+
+    struct Intersect {
+        float len;
+        glm::vec3 normal;
+        glm::vec3 center;
+        Material material;
+    };
+
+    struct Plane {
+        glm::vec3 normal;
+        Material material;
+    };
+
+    // Ray counters of one worker, padded to a cache line so workers don't share one
+    struct WorkerCount {
+        GLuint rays[4];
+        char padding[64 - 4 * sizeof(GLuint)];
+        WorkerCount() { rays[0] = rays[1] = rays[2] = rays[3] = 0; }
+    };
+
+    const std::vector<Sphere>* spheres;
+    const BVH* bvh;
+    const UniformGrid* grid;
+    RenderSettings settings;
+    Light light;
+
+    static Intersect miss()
+    {
+        Intersect i;
+        i.len = RT_MAX_LEN;
+        i.normal = i.center = glm::vec3(0.0f);
+        i.material.color = i.material.diff_spec_ref = glm::vec3(0.0f);
+        return i;
+    }
+
+    // GLSL pow() of a vector
+    static glm::vec3 pow3(glm::vec3 v, float e)
+    {
+        return glm::vec3(std::pow(v.x, e), std::pow(v.y, e), std::pow(v.z, e));
+    }
+
+    Intersect intersect(const Ray& ray, const Sphere& sphere) const
+    {
+        glm::vec3 c = glm::vec3(sphere.position_r);
+        glm::vec3 oc = c - ray.origin;
+        float l = glm::dot(ray.direction, oc);
+        float det = l * l - glm::dot(oc, oc) + sphere.position_r.w * sphere.position_r.w;
+        if (det < 0.0f) return miss();
+
+        float len = l - std::sqrt(det);
+        if (len < 0.0f) len = l + std::sqrt(det);
+        if (len < 0.0f) return miss();
+        Intersect i;
+        i.len = len;
+        i.normal = glm::normalize(ray.origin + len * ray.direction - c);
+        i.center = c;
+        i.material = sphere.material;
+        return i;
+    }
+
+    Intersect intersect(const Ray& ray, const Plane& plane) const
+    {
+        float len = -glm::dot(ray.origin, plane.normal) / glm::dot(ray.direction, plane.normal);
+        if (len < 0.0f) return miss();
+        Intersect i;
+        i.len = len;
+        i.normal = plane.normal;
+        i.center = glm::vec3(0.0f);
+        i.material = plane.material;
+        return i;
+    }
+
+    void testSphere(const Ray& ray, int i, Intersect& intersection) const
+    {
+        const Sphere& s = (*this->spheres)[i];
+        if (glm::dot(ray.direction, glm::vec3(s.position_r) - ray.origin) >= 0.0f) { // Prune those spheres at the back of the ray origin
+            Intersect sphere = this->intersect(ray, s);
+            if ((sphere.material.diff_spec_ref[0] > 0.0f || sphere.material.diff_spec_ref[1] > 0.0f) && sphere.len < intersection.len)
+                intersection = sphere;
+        }
+    }
+
+    static bool hitBox(const Ray& ray, glm::vec3 invDir, glm::vec3 bmin, glm::vec3 bmax, float maxLen)
+    {
+        glm::vec3 t0 = (bmin - ray.origin) * invDir;
+        glm::vec3 t1 = (bmax - ray.origin) * invDir;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxLen));
+        return enter <= exit;
+    }
+
+    void traceBVH(const Ray& ray, Intersect& intersection) const
+    {
+        glm::vec3 invDir = 1.0f / ray.direction;
+        const std::vector<BVHNode>& nodes = this->bvh->Nodes;
+        int node = 0;
+        while (node >= 0) {
+            const BVHNode& n = nodes[node];
+            if (hitBox(ray, invDir, n.bmin, n.bmax, intersection.len)) {
+                if (n.count == 0) { // Interior node, the first child follows directly
+                    node++;
+                    continue;
+                }
+                for (int i = 0; i < n.count; i++)
+                    this->testSphere(ray, this->bvh->Indices[n.first + i], intersection);
+            }
+            node = n.escape;
+        }
+    }
+
+    void traceGrid(const Ray& ray, Intersect& intersection) const
+    {
+        const UniformGrid& g = *this->grid;
+        glm::vec3 invDir = 1.0f / ray.direction;
+        glm::vec3 t0 = (g.Min - ray.origin) * invDir;
+        glm::vec3 t1 = (g.Max - ray.origin) * invDir;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, intersection.len));
+        if (enter > exit) return;
+
+        glm::vec3 p = ray.origin + enter * ray.direction;
+        int cell[3], stepDir[3];
+        float next[3], delta[3];
+        for (int axis = 0; axis < 3; axis++) {
+            cell[axis] = std::max(0, std::min(g.Resolution[axis] - 1, (int)std::floor((p[axis] - g.Min[axis]) / g.CellSize[axis])));
+            stepDir[axis] = (ray.direction[axis] > 0.0f) - (ray.direction[axis] < 0.0f);
+            next[axis] = (g.Min[axis] + (cell[axis] + (ray.direction[axis] >= 0.0f ? 1.0f : 0.0f)) * g.CellSize[axis] - ray.origin[axis]) * invDir[axis];
+            delta[axis] = std::abs(g.CellSize[axis] * invDir[axis]);
+        }
+
+        while (true) {
+            int c = cell[0] + g.Resolution[0] * (cell[1] + g.Resolution[1] * cell[2]);
+            for (int i = g.CellStart[c]; i < g.CellStart[c + 1]; i++)
+                this->testSphere(ray, g.Indices[i], intersection);
+
+            float cellExit = std::min(next[0], std::min(next[1], next[2]));
+            if (intersection.len <= cellExit) break; // Nothing in later cells can be closer
+
+            int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+            cell[axis] += stepDir[axis];
+            next[axis] += delta[axis];
+            if (cell[axis] < 0 || cell[axis] >= g.Resolution[axis]) break;
+        }
+    }
+
+    Intersect trace(const Ray& ray) const
+    {
+        Intersect intersection = miss();
+        if (this->settings.withPlane) {
+            Plane p;
+            p.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+            p.material.color = glm::vec3(1.0f, 1.0f, 1.0f);
+            p.material.diff_spec_ref = glm::vec3(0.5f, 0.5f, 0.0f);
+            Intersect plane = this->intersect(ray, p);
+            if (glm::length(plane.material.diff_spec_ref) > 0.0f) { intersection = plane; }
+        }
+        int num = (int)this->spheres->size();
+        if (this->settings.accel == ACCEL_BVH) {
+            if (num > 0) this->traceBVH(ray, intersection);
+        } else if (this->settings.accel == ACCEL_GRID) {
+            if (num > 0) this->traceGrid(ray, intersection);
+        } else {
+            for (int i = 0; i < num; i++)
+                this->testSphere(ray, i, intersection);
+        }
+        return intersection;
+    }
+
+    // blocks() in trace.glsl, testSphere() without the hit record
+    bool blocks(const Ray& ray, int i) const
+    {
+        const Sphere& s = (*this->spheres)[i];
+        glm::vec3 oc = glm::vec3(s.position_r) - ray.origin;
+        float l = glm::dot(ray.direction, oc);
+        if (l < 0.0f) return false; // Pruned like in testSphere(), in front of the origin the far hit is never behind it
+        float det = l * l - glm::dot(oc, oc) + s.position_r.w * s.position_r.w;
+        if (det < 0.0f) return false;
+        return s.material.diff_spec_ref[0] > 0.0f || s.material.diff_spec_ref[1] > 0.0f;
+    }
+
+    bool occludedBVH(const Ray& ray) const
+    {
+        glm::vec3 invDir = 1.0f / ray.direction;
+        const std::vector<BVHNode>& nodes = this->bvh->Nodes;
+        int node = 0;
+        while (node >= 0) {
+            const BVHNode& n = nodes[node];
+            if (hitBox(ray, invDir, n.bmin, n.bmax, RT_MAX_LEN)) {
+                if (n.count == 0) {
+                    node++;
+                    continue;
+                }
+                for (int i = 0; i < n.count; i++)
+                    if (this->blocks(ray, this->bvh->Indices[n.first + i])) return true;
+            }
+            node = n.escape;
+        }
+        return false;
+    }
+
+    bool occludedGrid(const Ray& ray) const
+    {
+        const UniformGrid& g = *this->grid;
+        glm::vec3 invDir = 1.0f / ray.direction;
+        glm::vec3 t0 = (g.Min - ray.origin) * invDir;
+        glm::vec3 t1 = (g.Max - ray.origin) * invDir;
+        glm::vec3 tNear = glm::min(t0, t1);
+        glm::vec3 tFar = glm::max(t0, t1);
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, RT_MAX_LEN));
+        if (enter > exit) return false;
+
+        glm::vec3 p = ray.origin + enter * ray.direction;
+        int cell[3], stepDir[3];
+        float next[3], delta[3];
+        for (int axis = 0; axis < 3; axis++) {
+            cell[axis] = std::max(0, std::min(g.Resolution[axis] - 1, (int)std::floor((p[axis] - g.Min[axis]) / g.CellSize[axis])));
+            stepDir[axis] = (ray.direction[axis] > 0.0f) - (ray.direction[axis] < 0.0f);
+            next[axis] = (g.Min[axis] + (cell[axis] + (ray.direction[axis] >= 0.0f ? 1.0f : 0.0f)) * g.CellSize[axis] - ray.origin[axis]) * invDir[axis];
+            delta[axis] = std::abs(g.CellSize[axis] * invDir[axis]);
+        }
+
+        while (true) {
+            int c = cell[0] + g.Resolution[0] * (cell[1] + g.Resolution[1] * cell[2]);
+            for (int i = g.CellStart[c]; i < g.CellStart[c + 1]; i++)
+                if (this->blocks(ray, g.Indices[i])) return true;
+
+            int axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+            cell[axis] += stepDir[axis];
+            next[axis] += delta[axis];
+            if (cell[axis] < 0 || cell[axis] >= g.Resolution[axis]) return false;
+        }
+    }
+
+    // occluded() in trace.glsl, true if trace(ray) would not return miss. Stops at the first blocker.
+    bool occluded(const Ray& ray) const
+    {
+        if (this->settings.withPlane && !(-ray.origin.y / ray.direction.y < 0.0f)) return true;
+        int num = (int)this->spheres->size();
+        if (this->settings.accel == ACCEL_BVH) {
+            if (num > 0) return this->occludedBVH(ray);
+        } else if (this->settings.accel == ACCEL_GRID) {
+            if (num > 0) return this->occludedGrid(ray);
+        } else {
+            for (int i = 0; i < num; i++)
+                if (this->blocks(ray, i)) return true;
+        }
+        return false;
+    }
+
+    glm::vec3 radiance(Ray ray, GLuint rayCount[4]) const
+    {
+        const glm::vec3 ambient = glm::vec3(0.6f, 0.8f, 1.0f) * RT_INTENSITY / RT_GAMMA;
+        const Light& light = this->light;
+        glm::vec3 color = glm::vec3(0.0f);
+        glm::vec3 fresnel = glm::vec3(0.0f);
+        glm::vec3 fresnel2 = glm::vec3(0.0f);
+        glm::vec3 fresnel3 = glm::vec3(0.0f);
+        glm::vec3 mask = glm::vec3(1.0f);
+        glm::vec3 mask2 = glm::vec3(1.0f);
+        int rayType = PRIMARY_RAY;
+
+        for (int i = 0; i <= this->settings.iterations; ++i) {
+            rayCount[rayType]++;
+            Intersect hit = this->trace(ray);
+            if (glm::length(hit.material.diff_spec_ref) > 0.0f) { // If hit
+                glm::vec3 r0 = hit.material.color * hit.material.diff_spec_ref[1];
+                float hv = glm::clamp(glm::dot(hit.normal, -ray.direction), 0.0f, 1.0f);
+                fresnel = r0 + (1.0f - r0) * std::pow(1.0f - hv, 5.0f);
+                mask *= fresnel;
+
+                if (this->settings.canRefract && hit.material.diff_spec_ref[2] > 0.0f) { // If refractive (transparent)
+                    glm::vec3 enter = ray.origin + hit.len * ray.direction;
+                    float radius = glm::distance(enter, hit.center); // Radius of the sphere that was hit, like in the shader
+                    glm::vec3 refraction_in = glm::refract(ray.direction, hit.normal, hit.material.diff_spec_ref[2]);
+                    glm::vec3 exit = enter + (glm::dot((hit.center - enter), refraction_in)) * refraction_in * 2.0f;
+                    glm::vec3 refraction_out = glm::refract(refraction_in, (hit.center - exit) / radius, 1.0f / hit.material.diff_spec_ref[2]);
+
+                    // Reflection ray for half transparent sphere
+                    glm::vec3 reflection = glm::reflect(ray.direction, hit.normal);
+                    Ray ray_reflect = Ray(enter + RT_EPSILON * reflection, reflection);
+                    rayCount[REFLECTION_RAY]++;
+                    Intersect hit_reflect = this->trace(ray_reflect);
+                    if (glm::length(hit_reflect.material.diff_spec_ref) > 0.0f) {
+                        rayCount[SHADOW_RAY]++;
+                        if (!this->occluded(Ray(ray_reflect.origin + hit_reflect.len * ray_reflect.direction + RT_EPSILON * light.direction, light.direction))) {
+                            color += glm::clamp(glm::dot(hit_reflect.normal, light.direction), 0.0f, 1.0f) * light.color
+                                * hit_reflect.material.color * hit_reflect.material.diff_spec_ref[0]
+                                * (1.0f - fresnel) * mask;
+                        }
+                    } else {
+                        color += mask * ambient;
+                    }
+
+                    // Fresnel for exiting the sphere
+                    hv = glm::clamp(glm::dot((hit.center - exit) / radius, -refraction_in), 0.0f, 1.0f);
+                    fresnel2 = r0 + (1.0f - r0) * std::pow(1.0f - hv, 5.0f);
+                    mask *= fresnel2;
+
+                    // Reflection of the refracted ray inside the sphere
+                    glm::vec3 reflect_inner = glm::reflect(refraction_in, (hit.center - exit) / radius);
+                    glm::vec3 exit2 = exit + reflect_inner * (glm::dot((hit.center - enter), refraction_in)) * 2.0f;
+                    glm::vec3 refraction_out2 = glm::refract(reflect_inner, (hit.center - exit2) / radius, 1.0f / hit.material.diff_spec_ref[2]);
+
+                    hv = glm::clamp(glm::dot((hit.center - exit2) / radius, -reflect_inner), 0.0f, 1.0f);
+                    fresnel3 = r0 + (1.0f - r0) * std::pow(1.0f - hv, 5.0f);
+                    mask2 = mask * fresnel3;
+                    Ray ray_reflect2 = Ray(exit2 + RT_EPSILON * refraction_out2, refraction_out2);
+                    rayCount[REFRACTION_RAY]++;
+                    Intersect hit_reflect2 = this->trace(ray_reflect2);
+
+                    if (glm::length(hit_reflect2.material.diff_spec_ref) > 0.0f) {
+                        rayCount[SHADOW_RAY]++;
+                        // Uses ray_reflect.direction like the shader does
+                        if (!this->occluded(Ray(ray_reflect2.origin + hit_reflect2.len * ray_reflect.direction + RT_EPSILON * light.direction, light.direction))) {
+                            color += glm::clamp(glm::dot(hit_reflect2.normal, light.direction), 0.0f, 1.0f) * light.color
+                                * hit_reflect2.material.color * hit_reflect2.material.diff_spec_ref[0]
+                                * (1.0f - fresnel3) * mask2;
+                        }
+                    } else {
+                        color += mask2 * ambient;
+                    }
+
+                    ray = Ray(exit + RT_EPSILON * refraction_out, refraction_out); // Next iteration ray: refracted
+                    rayType = REFRACTION_RAY;
+                    color += mask * (1.0f - fresnel2);
+
+                    if (glm::length(mask) < 0.03f) break;
+
+                } else { // Not refractive, only one reflection ray
+                    rayCount[SHADOW_RAY]++;
+                    if (!this->occluded(Ray(ray.origin + hit.len * ray.direction + RT_EPSILON * light.direction, light.direction))) {
+                        color += glm::clamp(glm::dot(hit.normal, light.direction), 0.0f, 1.0f) * light.color
+                            * hit.material.color * hit.material.diff_spec_ref[0]
+                            * (1.0f - fresnel) * mask / fresnel;
+                    }
+
+                    if (glm::length(mask) < 0.03f) break;
+                    glm::vec3 reflection = glm::reflect(ray.direction, hit.normal);
+                    ray = Ray(ray.origin + hit.len * ray.direction + RT_EPSILON * reflection, reflection); // Next ray: reflected
+                    rayType = REFLECTION_RAY;
+                }
+
+            } else { // Didn't hit any object
+                glm::vec3 spotlight = glm::vec3(1e6f) * std::pow(std::abs(glm::dot(ray.direction, light.direction)), 250.0f);
+                color += mask * (ambient + spotlight);
+                break;
+            }
+        }
+        return color;
+    }
+
+    // mainImage() for the pixel whose lower left corner is (x, y)
+    void shade(int x, int y, GLuint rayCount[4])
+    {
+        glm::vec2 resolution = glm::vec2(this->settings.width, this->settings.height);
+        glm::vec2 uv = (glm::vec2(x, y) + glm::vec2(0.5f)) / resolution - glm::vec2(0.5f);
+        uv.x *= resolution.x / resolution.y;
+
+        Ray ray = Ray(this->settings.viewPos, this->settings.rot * glm::normalize(glm::vec3(uv.x, uv.y, -1.0f)));
+        glm::vec3 c = pow3(this->radiance(ray, rayCount) * RT_EXPOSURE, 1.0f / RT_GAMMA);
+
+        unsigned char* out = &this->Image[(y * this->settings.width + x) * 3];
+        for (int i = 0; i < 3; i++)
+            out[i] = (unsigned char)(glm::clamp(c[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+};
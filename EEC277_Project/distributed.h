@@ -0,0 +1,279 @@
+#pragma once
+
+// Std. Includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Sockets
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "tiles.h"
+
+const GLuint DISTRIBUTED_TILE_SIZE = 64;    // Pixels along the side of a tile handed to a worker
+const int BATCHES_IN_FLIGHT = 2;            // Batches sent to a worker before its first result, hides the round trip
+
+// Messages between the coordinator and its workers. Both sides are the same program, so structs are sent as they are
+// in host byte order, which also means remote workers must run on the same architecture.
+//
+// Handshake: the coordinator sends the arguments the worker renders with as strings, the worker answers with its
+// GL renderer once its first pass is compiled. Then the coordinator sends batches, a BatchHeader followed by its
+// TileJobs, and the worker answers each one with a TileResult and the RGBA8 pixels of every tile, in the same order.
+// A batch without tiles ends the worker.
+struct BatchHeader {
+    uint32_t frame;
+    uint32_t seed;              // Seed of the roulette decisions of the frame
+    float viewPos[3];
+    float rot[9];
+    float light[3];
+    uint32_t tiles;
+};
+
+struct TileJob {
+    uint32_t index, x, y, width, height;
+};
+
+struct TileResult {
+    uint32_t index;
+    float ms;                   // Time the worker took to draw the tile
+    uint32_t rays[4];           // Rays of every type, summed over the tile
+};
+
+// Blocking stream socket that sends and receives whole messages
+class Connection
+{
+public:
+    int Fd;
+
+    Connection() : Fd(-1) {}
+
+    // Connects to host:port over TCP
+    bool Connect(const char* address)
+    {
+        std::string host(address);
+        size_t colon = host.rfind(':');
+        if (colon == std::string::npos) {
+            fprintf(stderr, "Expected host:port, got %s\n", address);
+            return false;
+        }
+        std::string port = host.substr(colon + 1);
+        host.erase(colon);
+        struct addrinfo hints, *found = NULL;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0) {
+            fprintf(stderr, "Cannot resolve %s\n", address);
+            return false;
+        }
+        for (struct addrinfo* a = found; a && this->Fd < 0; a = a->ai_next) {
+            this->Fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (this->Fd >= 0 && connect(this->Fd, a->ai_addr, a->ai_addrlen) != 0)
+                this->Close();
+        }
+        freeaddrinfo(found);
+        if (this->Fd < 0) {
+            fprintf(stderr, "Cannot connect to %s\n", address);
+            return false;
+        }
+        this->noDelay();
+        return true;
+    }
+
+    // Takes over a socket returned by accept()
+    void Adopt(int fd)
+    {
+        this->Fd = fd;
+        this->noDelay();
+    }
+
+    void Close()
+    {
+        if (this->Fd >= 0)
+            close(this->Fd);
+        this->Fd = -1;
+    }
+
+    bool Send(const void* data, size_t size)
+    {
+        const char* p = (const char*)data;
+        while (size > 0) {
+            ssize_t sent = send(this->Fd, p, size, 0);
+            if (sent <= 0)
+                return false;
+            p += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    // Fails when the other side has closed the connection
+    bool Receive(void* data, size_t size)
+    {
+        char* p = (char*)data;
+        while (size > 0) {
+            ssize_t received = recv(this->Fd, p, size, 0);
+            if (received <= 0)
+                return false;
+            p += received;
+            size -= received;
+        }
+        return true;
+    }
+
+    bool SendString(const std::string& s)
+    {
+        uint32_t length = (uint32_t)s.size();
+        return this->Send(&length, sizeof(length)) && this->Send(s.data(), length);
+    }
+
+    bool ReceiveString(std::string& s)
+    {
+        uint32_t length = 0;
+        if (!this->Receive(&length, sizeof(length)))
+            return false;
+        s.resize(length);
+        return length == 0 || this->Receive(&s[0], length);
+    }
+
+private:
+    // Batches are small and answered right away, Nagle's algorithm would hold them back
+    void noDelay()
+    {
+        int on = 1;
+        setsockopt(this->Fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    }
+};
+
+// TCP socket the workers connect to
+class Listener
+{
+public:
+    int Fd;
+    int Port;
+
+    Listener() : Fd(-1), Port(0) {}
+
+    // Port 0 picks a free one. Without anyAddress only workers on this machine can connect.
+    bool Listen(int port, bool anyAddress)
+    {
+        this->Fd = socket(AF_INET, SOCK_STREAM, 0);
+        int on = 1;
+        setsockopt(this->Fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(anyAddress ? INADDR_ANY : INADDR_LOOPBACK);
+        address.sin_port = htons(port);
+        socklen_t length = sizeof(address);
+        if (this->Fd < 0 || bind(this->Fd, (struct sockaddr*)&address, length) != 0 || listen(this->Fd, 64) != 0
+            || getsockname(this->Fd, (struct sockaddr*)&address, &length) != 0) {
+            fprintf(stderr, "Cannot listen on port %d\n", port);
+            this->Close();
+            return false;
+        }
+        this->Port = ntohs(address.sin_port);
+        return true;
+    }
+
+    // Waits up to timeoutMs for a worker, returns false if none connected
+    bool Accept(Connection& connection, int timeoutMs)
+    {
+        struct pollfd p = {this->Fd, POLLIN, 0};
+        if (poll(&p, 1, timeoutMs) <= 0)
+            return false;
+        int fd = accept(this->Fd, NULL, NULL);
+        if (fd < 0)
+            return false;
+        connection.Adopt(fd);
+        return true;
+    }
+
+    void Close()
+    {
+        if (this->Fd >= 0)
+            close(this->Fd);
+        this->Fd = -1;
+    }
+};
+
+// Tiles of a frame shared out to the workers in batches. The most expensive tiles go first and every batch is
+// estimated to take a fixed share of the work still left, so batches shrink towards the end of the frame and
+// a worker that finishes early picks up more of the rest (guided self-scheduling). Costs are the times the
+// workers measured for each tile in the last frame, so the split follows the image as the light moves.
+class TileQueue
+{
+public:
+    struct Tile {
+        GLuint X, Y, Width, Height;
+        double Cost;        // Milliseconds when last measured, negative if never
+    };
+    std::vector<Tile> Tiles;
+
+    TileQueue(GLuint width, GLuint height) : next(0)
+    {
+        for (GLuint y = 0; y < height; y += DISTRIBUTED_TILE_SIZE)
+            for (GLuint x = 0; x < width; x += DISTRIBUTED_TILE_SIZE) {
+                Tile t = {x, y, std::min(DISTRIBUTED_TILE_SIZE, width - x), std::min(DISTRIBUTED_TILE_SIZE, height - y), -1.0};
+                this->Tiles.push_back(t);
+            }
+    }
+
+    // Orders the tiles of a new frame by their last cost
+    void Start()
+    {
+        // Before any tile was measured all are assumed to cost the same
+        this->estimates.resize(this->Tiles.size());
+        for (size_t i = 0; i < this->Tiles.size(); i++)
+            this->estimates[i] = this->Tiles[i].Cost;
+        orderByCost(this->estimates, 1.0, this->order);
+        this->remaining = 0.0;
+        for (size_t i = 0; i < this->estimates.size(); i++)
+            this->remaining += this->estimates[i];
+        this->next = 0;
+    }
+
+    bool Empty() const
+    {
+        return this->next >= this->order.size();
+    }
+
+    // Next batch for one of workers, at least one tile
+    std::vector<TileJob> Next(int workers)
+    {
+        std::vector<TileJob> batch;
+        double share = this->remaining / (2.0 * workers), taken = 0.0;
+        while (!this->Empty() && (batch.empty() || taken < share)) {
+            int index = this->order[this->next++];
+            const Tile& t = this->Tiles[index];
+            TileJob job = {(uint32_t)index, t.X, t.Y, t.Width, t.Height};
+            batch.push_back(job);
+            taken += this->estimates[index];
+        }
+        this->remaining -= taken;
+        return batch;
+    }
+
+    void Measured(int index, double ms)
+    {
+        this->Tiles[index].Cost = ms;
+    }
+
+private:
+    std::vector<int> order;
+    std::vector<double> estimates;  // Milliseconds every tile of the current frame is expected to take
+    size_t next;
+    double remaining;       // Estimated milliseconds of the tiles not handed out yet
+};
@@ -1,93 +1,85 @@
 #version 410 core
 
-struct Ray {
-    vec3 origin;
-    vec3 direction;
-};
-
-struct Light {
-    vec3 color;
-    vec3 direction;
-};
-
-struct Material {
-    vec3 color;
-    vec3 diff_spec_ref;
-};
-
-struct Intersect {
-    float len;
-    vec3 normal;
-    vec3 center;
-    Material material;
-};
-
-struct Sphere {
-    vec4 position_r;
-    Material material;
-};
-
-struct Plane {
-    vec3 normal;
-    Material material;
-};
-
-uniform int       num_spheres;           // Sphere number
-uniform Sphere    spheres[338];          // Sphere Array
+#ifdef PROFILE
+#extension GL_ARB_shader_clock : enable
+#endif
+
+#include "trace.glsl"
+
 uniform vec3      resolution;            // Viewport resolution (in pixels)
 uniform vec3      viewPos;               // View Position
-uniform vec3      light_direction;       // Light direction for static/moving light
 uniform mat3      rot;                   // Rotation Matrix
+uniform vec2      jitter;                // Subpixel offset of this sample in progressive mode, 0 is the pixel center
+#ifdef ITERATIONS
+const int         iterations = ITERATIONS;  // Specialized variant, constant loop bound
+#else
 uniform int       iterations;            // Bouncing limit
-uniform bool      withPlane;             // Has a plane or not
+#endif
+#ifdef CAN_REFRACT
+const bool        canRefract = CAN_REFRACT; // Specialized variant, the refraction branch is removed when false
+#else
 uniform bool      canRefract;            // Enable refraction
+#endif
+#ifdef ROULETTE
+const bool        roulette = ROULETTE;   // Specialized variant, the fixed cutoff or Russian roulette is chosen at compile time
+#else
+uniform bool      roulette;              // Russian roulette instead of the fixed throughput cutoff
+#endif
+uniform uint      seed;                  // Changes every frame, so roulette decisions average out over frames
+#ifdef SCREEN_BINS
+uniform isamplerBuffer tile_cells;       // First entry in tile_spheres of every SCREEN_BINS square screen tile, plus one past the end
+uniform isamplerBuffer tile_spheres;     // Spheres a primary ray through the tile can hit, built by ScreenBins
+uniform int       tile_columns;          // Screen tiles per row
+#endif
 
 layout(location = 0) out vec4 color;
-layout(location = 1) out vec4 totalRay;
-
-const float epsilon = 1e-3;
-const float exposure = 1e-2;
-const float gamma = 2.2;
-const float intensity = 100.0;
-const vec3 ambient = vec3(0.6, 0.8, 1.0) * intensity / gamma;
-const float MAX_LEN = 2147483647.0;
-const Intersect miss = Intersect(MAX_LEN, vec3(0.0), vec3(0.0), Material(vec3(0.0), vec3(0.0)));
-Light light = Light(vec3(1.0, 1.0, 1.0) * intensity, normalize(light_direction)); // Light source, can be fixed or moving
-float rayCount = 1.0f; // Ray calculation count for this pixel
-
-Intersect intersect(Ray ray, Sphere sphere) {
-    vec3 oc = sphere.position_r.xyz - ray.origin;
-    float l = dot(ray.direction, oc);
-    float det = pow(l, 2.0) - dot(oc, oc) + pow(sphere.position_r.w, 2.0);
-    if (det < 0.0) return miss;
-    
-    float len = l - sqrt(det);
-    if (len < 0.0) len = l + sqrt(det);
-    if (len < 0.0) return miss;
-    return Intersect(len, (ray.origin + len*ray.direction - sphere.position_r.xyz) / sphere.position_r.w, sphere.position_r.xyz, sphere.material);
+layout(location = 1) out uvec4 totalRay;   // Rays traced by this pixel: primary, reflection, refraction, shadow
+layout(location = 2) out vec4 accumulation; // Clamped linear color with weight 1, summed by additive blending in progressive mode
+layout(location = 3) out uvec2 bounceDepth; // Bounces of the path and how many of them had a throughput below LOW_THROUGHPUT
+#ifdef PROFILE
+layout(location = 4) out uvec4 cost;       // Rays, sphere tests, bounces and shader clock cycles of this pixel
+#endif
+
+const float LOW_THROUGHPUT = 0.1;   // Bounces with a smaller mask contribute almost nothing to the pixel
+
+uvec4 rayCount = uvec4(0u); // Ray calculation count for this pixel, one component per ray type
+uvec2 bounces = uvec2(0u);  // Path length and low throughput bounces of this pixel
+
+// Uniform random number in [0, 1) for this pixel, frame and bounce. PCG hash, no state is carried between calls.
+float random(int bounce) {
+    uint v = uint(gl_FragCoord.x) * 1973u + uint(gl_FragCoord.y) * 9277u + uint(bounce) * 26699u + seed * 104729u;
+    v = v * 747796405u + 2891336453u;
+    uint word = ((v >> ((v >> 28u) + 4u)) ^ v) * 277803737u;
+    word = (word >> 22u) ^ word;
+    return float(word >> 8u) / 16777216.0;
 }
 
-Intersect intersect(Ray ray, Plane plane) {
-    float len = -dot(ray.origin, plane.normal) / dot(ray.direction, plane.normal);
-    if (len < 0.0) return miss;
-    return Intersect(len, plane.normal, vec3(0.0), plane.material);
+// Decides whether the path ends after this bounce. Without roulette the path stops once the mask is negligible.
+// With roulette it survives with a probability that follows the mask, and survivors are scaled up by its inverse
+// so the expected color stays the same. The first hit keeps the fixed cutoff, so directly visible surfaces stay noise free.
+bool terminate(inout vec3 mask, int bounce) {
+    if (!roulette || bounce == 0)
+        return length(mask) < 0.03;
+    float survival = clamp(max(mask.r, max(mask.g, mask.b)), 0.05, 1.0);
+    if (random(bounce) >= survival)
+        return true;
+    mask /= survival;
+    return false;
 }
 
-Intersect trace(Ray ray) {
-    Intersect intersection = miss;
-    if (withPlane) {
-        Intersect plane = intersect(ray, Plane(vec3(0, 1, 0), Material(vec3(1.0, 1.0, 1.0), vec3(0.5, 0.5, 0.0))));
-        if (length(plane.material.diff_spec_ref)> 0.0) { intersection = plane; }
-    }
-    for (int i = 0; i < num_spheres; i++) {
-        if(dot(ray.direction, spheres[i].position_r.xyz - ray.origin) >= 0) { // Prune those spheres at the back of the ray origin
-            Intersect sphere = intersect(ray, spheres[i]);
-            if ((sphere.material.diff_spec_ref[0] > 0.0 || sphere.material.diff_spec_ref[1] > 0.0)  && sphere.len < intersection.len) // If hit and in front of the last test hit
-                intersection = sphere;
-        }
-    }
-    return intersection;
+#ifdef SCREEN_BINS
+// Closest hit of the primary ray, only the spheres binned to the screen tile of this pixel are tested
+Intersect tracePrimary(Ray ray) {
+    HitRecord intersection = noHit;
+    if (withPlane) testPlane(ray, intersection);
+    ivec2 t = ivec2(gl_FragCoord.xy) / SCREEN_BINS;
+    int tile = t.x + tile_columns * t.y;
+    int end = texelFetch(tile_cells, tile + 1).x;
+    for (int i = texelFetch(tile_cells, tile).x; i < end; i++)
+        testSphere(ray, texelFetch(tile_spheres, i).x, intersection);
+    return resolve(ray, intersection);
 }
+#endif
 
 vec3 radiance(Ray ray) {
     vec3 color = vec3(0.0);
@@ -96,9 +88,18 @@ vec3 radiance(Ray ray) {
     vec3 fresnel3 = vec3(0.0); 
     vec3 mask = vec3(1.0);
     vec3 mask2 = vec3(1.0);
+    int rayType = PRIMARY_RAY; // Type of the ray traced at the top of the loop
     
     for (int i = 0; i <= iterations; ++i) {
+        rayCount[rayType]++;
+        bounces.x++;
+        if (max(mask.r, max(mask.g, mask.b)) < LOW_THROUGHPUT)
+            bounces.y++;
+#ifdef SCREEN_BINS
+        Intersect hit = i == 0 ? tracePrimary(ray) : trace(ray);
+#else
         Intersect hit = trace(ray);
+#endif
         if (length(hit.material.diff_spec_ref)> 0.0) { // If hit
 
             //----------------------------------------------fresnel for the first hit
@@ -110,19 +111,21 @@ vec3 radiance(Ray ray) {
             if(canRefract && hit.material.diff_spec_ref[2] > 0.0){ // If refractive (transparent)
 
                 vec3 enter = ray.origin + hit.len * ray.direction; // enter : where the first ray hit the sphere
+                float radius = distance(enter, hit.center); // Radius of the sphere that was hit, enter lies on its surface
                 vec3 refraction_in = refract(ray.direction, hit.normal, hit.material.diff_spec_ref[2]);// direction of refraction ray
                 vec3 exit = enter + (dot((hit.center-enter),refraction_in))*refraction_in*2; // exit : where ray exit sphere after refraction travel inside
-                vec3 refraction_out = refract(refraction_in, (hit.center-exit)/spheres[0].position_r.w, 1/hit.material.diff_spec_ref[2]);// direction of exiting ray
+                vec3 refraction_out = refract(refraction_in, (hit.center-exit)/radius, 1/hit.material.diff_spec_ref[2]);// direction of exiting ray
 
 
 //------------------------------------------------------------------reflection ray for half transparent sphere (one ray, no iteration)
                 vec3 reflection = reflect(ray.direction, hit.normal);
                 Ray ray_reflect = Ray(enter + epsilon * reflection, reflection);
-                rayCount += rayCount + 1.0f;
+                rayCount[REFLECTION_RAY]++;
                 Intersect hit_reflect = trace(ray_reflect);
                 if (length(hit_reflect.material.diff_spec_ref) > 0.0) { // If hit
 
-                    if (trace(Ray(ray_reflect.origin + hit_reflect.len * ray_reflect.direction + epsilon * light.direction, light.direction)) == miss) {
+                    rayCount[SHADOW_RAY]++;
+                    if (!occluded(Ray(ray_reflect.origin + hit_reflect.len * ray_reflect.direction + epsilon * light.direction, light.direction))) {
                         color += clamp(dot(hit_reflect.normal, light.direction), 0.0, 1.0) * light.color
                         * hit_reflect.material.color * hit_reflect.material.diff_spec_ref[0]
                         * (1.0 - fresnel) * mask;
@@ -139,27 +142,28 @@ vec3 radiance(Ray ray) {
 
 
                 //----------------------------------------------fresnel(2) for exiting sphere
-                float hv = clamp(dot((hit.center-exit)/spheres[0].position_r.w, -refraction_in), 0.0, 1.0); // cos(theta)
+                float hv = clamp(dot((hit.center-exit)/radius, -refraction_in), 0.0, 1.0); // cos(theta)
                 fresnel2 = r0 + (1.0 - r0) * pow(1.0 - hv, 5.0); // Schlick approximation: fresnel = R0 + (1 - R0) * (1 - cos(theta))^5
                 mask *= fresnel2; // Accumulated color mask
 
 
 //----------------------------------------------------------------reflection of refracted ray inside the sphere (one ray, no iteration)
-                vec3 reflect_inner = reflect(refraction_in, (hit.center-exit)/spheres[0].position_r.w); // inner reflection
-                vec3 exit2 = reflect_inner*(dot((hit.center-enter),refraction_in))*2; //point where inner reflection exit sphere // same length as the first refraction
-                vec3 refraction_out2 = refract(reflect_inner, (hit.center-exit2)/spheres[0].position_r.w, 1/hit.material.diff_spec_ref[2]);//direction
+                vec3 reflect_inner = reflect(refraction_in, (hit.center-exit)/radius); // inner reflection
+                vec3 exit2 = exit + reflect_inner*(dot((hit.center-enter),refraction_in))*2; //point where inner reflection exit sphere // same length as the first refraction
+                vec3 refraction_out2 = refract(reflect_inner, (hit.center-exit2)/radius, 1/hit.material.diff_spec_ref[2]);//direction
                 
                 //----------------------------------------------fresnel(3) for the refracted and reflected ray exiting sphere
-                hv = clamp(dot((hit.center-exit2)/spheres[0].position_r.w, -reflect_inner), 0.0, 1.0); // cos(theta)
+                hv = clamp(dot((hit.center-exit2)/radius, -reflect_inner), 0.0, 1.0); // cos(theta)
                 fresnel3 = r0 + (1.0 - r0) * pow(1.0 - hv, 5.0); // Schlick approximation: fresnel = R0 + (1 - R0) * (1 - cos(theta))^5
                 mask2 = mask * fresnel3; // Accumulated color mask. mask2 specificlly for this single ray
                 Ray ray_reflect2 = Ray(exit2 + epsilon * refraction_out2, refraction_out2);
-                rayCount += rayCount + 1.0f;
+                rayCount[REFRACTION_RAY]++;
                 Intersect hit_reflect2 = trace(ray_reflect2);
                 
                 if (length(hit_reflect2.material.diff_spec_ref) > 0.0) { // If hit
 
-                    if (trace(Ray(ray_reflect2.origin + hit_reflect2.len * ray_reflect.direction + epsilon * light.direction, light.direction)) == miss) {
+                    rayCount[SHADOW_RAY]++;
+                    if (!occluded(Ray(ray_reflect2.origin + hit_reflect2.len * ray_reflect.direction + epsilon * light.direction, light.direction))) {
                         color += clamp(dot(hit_reflect2.normal, light.direction), 0.0, 1.0) * light.color
                         * hit_reflect2.material.color * hit_reflect2.material.diff_spec_ref[0]
                         * (1.0 - fresnel3) * mask2;
@@ -175,13 +179,14 @@ vec3 radiance(Ray ray) {
 
             
                 ray = Ray(exit + epsilon * refraction_out, refraction_out);  // next iteraion ray: refracted
-                rayCount += rayCount + 1.0f;
+                rayType = REFRACTION_RAY;
                 color += mask *  (1.0-fresnel2); // transmittance * old mask
 
-                if(length(mask) < 0.03) break;
+                if(terminate(mask, i)) break;
 
             } else { // not refractive, only one refrection ray
-                if (trace(Ray(ray.origin + hit.len * ray.direction + epsilon * light.direction, light.direction)) == miss) {
+                rayCount[SHADOW_RAY]++;
+                if (!occluded(Ray(ray.origin + hit.len * ray.direction + epsilon * light.direction, light.direction))) {
                     color += clamp(dot(hit.normal, light.direction), 0.0, 1.0) * light.color
                     * hit.material.color * hit.material.diff_spec_ref[0]
                     * (1.0 - fresnel) * mask / fresnel;
@@ -190,10 +195,10 @@ vec3 radiance(Ray ray) {
                     // 3rd line : transmittance * old mask
                 }
            
-                if(length(mask) < 0.03) break;            
+                if(terminate(mask, i)) break;
                 vec3 reflection = reflect(ray.direction, hit.normal);
                 ray = Ray(ray.origin + hit.len * ray.direction + epsilon * reflection, reflection);// next ray: reflected
-                rayCount += rayCount + 1.0f;
+                rayType = REFLECTION_RAY;
             }
             
         } else { // didn't hit any object
@@ -208,21 +213,33 @@ vec3 radiance(Ray ray) {
     return color;
 }
 
-void mainImage(out vec4 fragColor, out vec4 count, in vec2 fragCoord) {
-    vec2 uv = fragCoord.xy / resolution.xy - vec2(0.5);
+void mainImage(out vec4 fragColor, out uvec4 count, out vec4 accum, out uvec2 depth, in vec2 fragCoord) {
+    vec2 uv = (fragCoord.xy + jitter) / resolution.xy - vec2(0.5);
     uv.x *= resolution.x / resolution.y;
    
 //    Ray ray = Ray(viewPos, normalize(mat3(projection * view) * vec3(uv.x, uv.y, 1.0f))); // With projection and view
     Ray ray = Ray(viewPos, rot * normalize(vec3(uv.x, uv.y, -1.0)));
     
-    fragColor = vec4(pow(radiance(ray) * exposure, vec3(1.0f / gamma)), 1.0f);
-    count = vec4(rayCount / 255.0f, 0.0f, 0.0f, 1.0f); // Put ray calculation count in red color of output vector
+    vec3 linearColor = radiance(ray) * exposure;
+    fragColor = vec4(pow(linearColor, vec3(1.0f / gamma)), 1.0f);
+    accum = vec4(clamp(linearColor, 0.0, 1.0), 1.0); // Clamped like the RGBA8 image, so the spotlight does not swamp the average
+    count = rayCount; // Exact counts, summed over the screen by ray_stats.frag
+    depth = bounces;
 }
 
 
 
 void main()
 {
-    mainImage(color, totalRay, gl_FragCoord.xy);
+#if defined(PROFILE) && defined(GL_ARB_shader_clock)
+    uvec2 start = clock2x32ARB();
+#endif
+    mainImage(color, totalRay, accumulation, bounceDepth, gl_FragCoord.xy);
+#ifdef PROFILE
+    cost = uvec4(rayCount.x + rayCount.y + rayCount.z + rayCount.w, sphereTests, bounces.x, 0u);
+#ifdef GL_ARB_shader_clock
+    cost.w = clock2x32ARB().x - start.x; // Low word only, wraps correctly below 2^32 cycles
+#endif
+#endif
 }
 
@@ -0,0 +1,117 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+
+// Grid build options
+const float GRID_DENSITY  = 1.0f;   // Target number of spheres per cell
+const int   GRID_MAX_RES  = 256;    // Upper bound of cells along one axis
+
+// Uniform grid over the sphere bounds with a list of overlapping spheres per cell.
+// Built in linear time with a counting sort, so it is cheap enough to rebuild every frame for moving spheres.
+// The shader walks the cells along the ray with a 3D-DDA.
+class UniformGrid
+{
+public:
+    glm::vec3 Min;                  // Lower corner of the grid
+    glm::vec3 Max;                  // Upper corner of the grid
+    glm::vec3 CellSize;
+    GLint Resolution[3];            // Number of cells along x, y and z
+    std::vector<GLint> CellStart;   // Cell c owns Indices[CellStart[c], CellStart[c + 1])
+    std::vector<GLint> Indices;     // Sphere indices grouped by cell
+
+    UniformGrid() : Min(glm::vec3(0.0f)), Max(glm::vec3(0.0f)), CellSize(glm::vec3(1.0f))
+    {
+        this->Resolution[0] = this->Resolution[1] = this->Resolution[2] = 1;
+    }
+
+    // Builds the grid from scratch
+    void Build(const std::vector<Sphere>& spheres)
+    {
+        AABB box;
+        for (size_t i = 0; i < spheres.size(); i++) {
+            glm::vec3 c = glm::vec3(spheres[i].position_r.x, spheres[i].position_r.y, spheres[i].position_r.z);
+            box.Grow(c - glm::vec3(spheres[i].position_r.w));
+            box.Grow(c + glm::vec3(spheres[i].position_r.w));
+        }
+        if (spheres.empty()) {
+            box.bmin = glm::vec3(0.0f);
+            box.bmax = glm::vec3(1.0f);
+        }
+        this->Min = box.bmin;
+        this->Max = box.bmax;
+
+        // Choose cubic-ish cells so that there are about GRID_DENSITY spheres per cell
+        glm::vec3 extent = glm::max(box.bmax - box.bmin, glm::vec3(1e-4f));
+        float volume = extent.x * extent.y * extent.z;
+        float cellsPerUnit = cbrt(GRID_DENSITY * std::max((size_t)1, spheres.size()) / volume);
+        for (int axis = 0; axis < 3; axis++) {
+            this->Resolution[axis] = std::max(1, std::min(GRID_MAX_RES, (int)ceil(extent[axis] * cellsPerUnit)));
+            this->CellSize[axis] = extent[axis] / this->Resolution[axis];
+        }
+
+        // Counting sort: count spheres per cell, prefix sum, then scatter
+        int cells = this->Resolution[0] * this->Resolution[1] * this->Resolution[2];
+        this->CellStart.assign(cells + 1, 0);
+        for (size_t i = 0; i < spheres.size(); i++) {
+            int lo[3], hi[3];
+            this->cellRange(spheres[i], lo, hi);
+            for (int z = lo[2]; z <= hi[2]; z++)
+                for (int y = lo[1]; y <= hi[1]; y++)
+                    for (int x = lo[0]; x <= hi[0]; x++)
+                        this->CellStart[this->cellIndex(x, y, z) + 1]++;
+        }
+        for (int c = 0; c < cells; c++)
+            this->CellStart[c + 1] += this->CellStart[c];
+
+        std::vector<GLint> fill(this->CellStart.begin(), this->CellStart.end() - 1);
+        this->Indices.resize(this->CellStart[cells]);
+        for (size_t i = 0; i < spheres.size(); i++) {
+            int lo[3], hi[3];
+            this->cellRange(spheres[i], lo, hi);
+            for (int z = lo[2]; z <= hi[2]; z++)
+                for (int y = lo[1]; y <= hi[1]; y++)
+                    for (int x = lo[0]; x <= hi[0]; x++)
+                        this->Indices[fill[this->cellIndex(x, y, z)]++] = (GLint)i;
+        }
+    }
+
+    // Total number of cells
+    int Cells() const { return this->Resolution[0] * this->Resolution[1] * this->Resolution[2]; }
+
+    // Passes the grid layout to the shader
+    void SetUniforms(GLuint program) const
+    {
+        glUniform3f(glGetUniformLocation(program, "grid_min"), this->Min.x, this->Min.y, this->Min.z);
+        glUniform3f(glGetUniformLocation(program, "grid_max"), this->Max.x, this->Max.y, this->Max.z);
+        glUniform3f(glGetUniformLocation(program, "grid_cell_size"), this->CellSize.x, this->CellSize.y, this->CellSize.z);
+        glUniform3i(glGetUniformLocation(program, "grid_res"), this->Resolution[0], this->Resolution[1], this->Resolution[2]);
+    }
+
+private:
+    int cellIndex(int x, int y, int z) const
+    {
+        return x + this->Resolution[0] * (y + this->Resolution[1] * z);
+    }
+
+    // Range of cells overlapped by the bounds of a sphere, inclusive
+    void cellRange(const Sphere& sphere, int lo[3], int hi[3]) const
+    {
+        for (int axis = 0; axis < 3; axis++) {
+            float c = sphere.position_r[axis];
+            float r = sphere.position_r.w;
+            lo[axis] = (int)floor((c - r - this->Min[axis]) / this->CellSize[axis]);
+            hi[axis] = (int)floor((c + r - this->Min[axis]) / this->CellSize[axis]);
+            lo[axis] = std::max(0, std::min(this->Resolution[axis] - 1, lo[axis]));
+            hi[axis] = std::max(0, std::min(this->Resolution[axis] - 1, hi[axis]));
+        }
+    }
+};
@@ -0,0 +1,103 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+
+// EGL Includes. Surfaceless contexts are only available through Mesa's EGL on Linux.
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// An offscreen OpenGL context with no window and no default framebuffer. Everything has to be rendered into an FBO.
+// Used by the benchmark farm, where there is no display and only Mesa (llvmpipe) is installed.
+class HeadlessContext
+{
+public:
+#ifdef __linux__
+    EGLDisplay Display;
+    EGLContext Context;
+#endif
+
+    HeadlessContext()
+    {
+#ifdef __linux__
+        this->Display = EGL_NO_DISPLAY;
+        this->Context = EGL_NO_CONTEXT;
+#endif
+    }
+
+    // Creates a core profile context of the given version and makes it current. Returns false if it is not supported.
+    bool Create(int major, int minor)
+    {
+#ifdef __linux__
+        // Prefer the surfaceless platform so that no X11 or Wayland connection is ever made
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay)
+            this->Display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (this->Display == EGL_NO_DISPLAY)
+            this->Display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (this->Display == EGL_NO_DISPLAY || !eglInitialize(this->Display, NULL, NULL)) {
+            std::cout << "ERROR::HEADLESS:: Failed to initialize EGL display" << std::endl;
+            return false;
+        }
+
+        // The surfaceless platform only exposes pbuffer configs, we never create the pbuffer itself
+        const EGLint configAttribs[] = {
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_NONE};
+        EGLConfig config;
+        EGLint numConfigs = 0;
+        if (!eglChooseConfig(this->Display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+            std::cout << "ERROR::HEADLESS:: No EGL config supports desktop OpenGL" << std::endl;
+            return false;
+        }
+
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            std::cout << "ERROR::HEADLESS:: EGL cannot bind the OpenGL API" << std::endl;
+            return false;
+        }
+
+        const EGLint contextAttribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, major,
+            EGL_CONTEXT_MINOR_VERSION, minor,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE};
+        this->Context = eglCreateContext(this->Display, config, EGL_NO_CONTEXT, contextAttribs);
+        if (this->Context == EGL_NO_CONTEXT) {
+            std::cout << "ERROR::HEADLESS:: Failed to create OpenGL " << major << "." << minor << " core context" << std::endl;
+            return false;
+        }
+
+        // Needs EGL_KHR_surfaceless_context, which Mesa always provides
+        if (!eglMakeCurrent(this->Display, EGL_NO_SURFACE, EGL_NO_SURFACE, this->Context)) {
+            std::cout << "ERROR::HEADLESS:: Failed to make surfaceless context current" << std::endl;
+            return false;
+        }
+        return true;
+#else
+        std::cout << "ERROR::HEADLESS:: EGL surfaceless contexts are not available on this platform" << std::endl;
+        return false;
+#endif
+    }
+
+    // Releases the context and the display connection
+    void Destroy()
+    {
+#ifdef __linux__
+        if (this->Display == EGL_NO_DISPLAY)
+            return;
+        eglMakeCurrent(this->Display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (this->Context != EGL_NO_CONTEXT)
+            eglDestroyContext(this->Display, this->Context);
+        eglTerminate(this->Display);
+        this->Display = EGL_NO_DISPLAY;
+        this->Context = EGL_NO_CONTEXT;
+#endif
+    }
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+// Std. Includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+// zlib for the deflate stream of the PNG files
+#include <zlib.h>
+
+// Writes an RGBA8 image with the bottom row first, as glReadPixels() returns it, to an RGB PNG file.
+// Every row uses the Sub filter, which helps deflate on smooth gradients at almost no cost.
+inline bool writePNG(const char* path, const unsigned char* pixels, uint32_t width, uint32_t height)
+{
+    std::vector<unsigned char> raw((size_t)(1 + 3 * width) * height);
+    for (uint32_t y = 0; y < height; y++) {
+        const unsigned char* src = pixels + (size_t)(height - 1 - y) * width * 4;
+        unsigned char* dst = &raw[(size_t)y * (1 + 3 * width)];
+        *dst++ = 1;
+        for (uint32_t x = 0; x < width; x++)
+            for (int c = 0; c < 3; c++)
+                dst[3 * x + c] = src[4 * x + c] - (x > 0 ? src[4 * (x - 1) + c] : 0);
+    }
+    uLongf size = compressBound(raw.size());
+    std::vector<unsigned char> deflated(size);
+    if (compress2(&deflated[0], &size, &raw[0], raw.size(), Z_BEST_SPEED) != Z_OK)
+        return false;
+
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return false;
+    const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    bool ok = fwrite(signature, 1, 8, f) == 8;
+    // Length, type, data and the CRC of type and data, all big endian
+    auto chunk = [&](const char* type, const unsigned char* data, uint32_t length) {
+        unsigned char header[8] = {(unsigned char)(length >> 24), (unsigned char)(length >> 16), (unsigned char)(length >> 8), (unsigned char)length,
+                                   (unsigned char)type[0], (unsigned char)type[1], (unsigned char)type[2], (unsigned char)type[3]};
+        uLong crc = crc32(crc32(0L, Z_NULL, 0), header + 4, 4);
+        if (length > 0)
+            crc = crc32(crc, data, length);
+        unsigned char footer[4] = {(unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8), (unsigned char)crc};
+        ok = ok && fwrite(header, 1, 8, f) == 8 && (length == 0 || fwrite(data, 1, length, f) == length) && fwrite(footer, 1, 4, f) == 4;
+    };
+    unsigned char ihdr[13] = {(unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+                              (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+                              8, 2, 0, 0, 0}; // 8 bits per channel, RGB, deflate, adaptive filters, no interlace
+    chunk("IHDR", ihdr, 13);
+    chunk("IDAT", &deflated[0], (uint32_t)size);
+    chunk("IEND", NULL, 0);
+    return fclose(f) == 0 && ok;
+}
+
+// Encodes frames to PNG files on a set of writer threads, so the render loop only hands over a buffer.
+// There are two buffers per thread. Acquire() blocks while all of them wait for encoding, which is how
+// a render loop that outruns the encoders is slowed down, and the time spent there is reported.
+class ImageWriter
+{
+public:
+    long Written;           // Files written so far
+    long Failed;            // Files that could not be written
+    double EncodeMs;        // Milliseconds spent encoding and writing, summed over the threads
+    double StallMs;         // Milliseconds Acquire() waited for a free buffer
+
+    // 0 threads uses one per hardware thread
+    ImageWriter(int threads, uint32_t width, uint32_t height) : Written(0), Failed(0), EncodeMs(0.0), StallMs(0.0),
+        width(width), height(height), busy(0), stop(false)
+    {
+        if (threads <= 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        this->buffers.resize(2 * threads);
+        for (size_t i = 0; i < this->buffers.size(); i++) {
+            this->buffers[i].resize((size_t)width * height * 4);
+            this->idle.push_back(&this->buffers[i][0]);
+        }
+        for (int i = 0; i < threads; i++)
+            this->threads.push_back(std::thread(&ImageWriter::worker, this));
+    }
+
+    ~ImageWriter()
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stop = true;
+        }
+        this->wake.notify_all();
+        for (size_t i = 0; i < this->threads.size(); i++)
+            this->threads[i].join();
+    }
+
+    int Threads() const
+    {
+        return (int)this->threads.size();
+    }
+
+    // A buffer of width * height RGBA8 pixels, to be handed back with Submit() or Release()
+    unsigned char* Acquire()
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->done.wait(guard, [this] { return !this->idle.empty(); });
+        unsigned char* pixels = this->idle.back();
+        this->idle.pop_back();
+        this->StallMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return pixels;
+    }
+
+    // Hands back a buffer that was not filled
+    void Release(unsigned char* pixels)
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->idle.push_back(pixels);
+        this->done.notify_all();
+    }
+
+    // Queues the pixels for encoding to path, the buffer is free again once the file is written
+    void Submit(unsigned char* pixels, const std::string& path)
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            Job job = {pixels, path};
+            this->jobs.push_back(job);
+        }
+        this->wake.notify_one();
+    }
+
+    // Waits until every submitted file is written
+    void Finish()
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->done.wait(guard, [this] { return this->jobs.empty() && this->busy == 0; });
+    }
+
+private:
+    struct Job {
+        unsigned char* pixels;
+        std::string path;
+    };
+
+    uint32_t width, height;
+    std::vector<std::vector<unsigned char> > buffers;
+    std::vector<unsigned char*> idle;    // Buffers nobody is filling or encoding
+    std::deque<Job> jobs;
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;   // A job was queued or the writer stops
+    std::condition_variable done;   // A buffer was freed
+    int busy;                       // Jobs being encoded
+    bool stop;
+
+    void worker()
+    {
+        std::unique_lock<std::mutex> guard(this->lock);
+        while (true) {
+            this->wake.wait(guard, [this] { return this->stop || !this->jobs.empty(); });
+            if (this->jobs.empty())
+                return;
+            Job job = this->jobs.front();
+            this->jobs.pop_front();
+            this->busy++;
+            guard.unlock();
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            bool ok = writePNG(job.path.c_str(), job.pixels, this->width, this->height);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            guard.lock();
+            this->EncodeMs += ms;
+            if (ok)
+                this->Written++;
+            else {
+                this->Failed++;
+                fprintf(stderr, "Cannot write %s\n", job.path.c_str());
+            }
+            this->busy--;
+            this->idle.push_back(job.pixels);
+            this->done.notify_all();
+        }
+    }
+};
@@ -0,0 +1,106 @@
+// Microbenchmark of the ray-sphere intersection kernels in intersect_kernels.h.
+// Traces the primary rays of a small image against the sphere lattice of main.cpp with every kernel
+// the CPU supports, and writes intersections per second and the speedup over the scalar loop to IntersectBench.txt.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <cmath>
+#include <vector>
+#include <chrono>
+
+#include "intersect_kernels.h"
+
+#define BENCH_WIDTH     64      // Primary rays per row
+#define BENCH_HEIGHT    48      // Rows of primary rays
+#define BENCH_SECONDS   0.5     // Minimum time spent on one kernel and sphere count
+
+const int numbers[] = {1, 8, 27, 64, 125, 216, 1000, 10000, 100000};
+
+double getTime()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Same lattice as main.cpp
+void buildSpheres(int nums, SphereSoA& spheres)
+{
+    int scale = int(cbrt(nums));
+    spheres.Resize(nums);
+    for(int i = 0; i < nums; i++)
+        spheres.Set(i, -3.0f + 1.5f * (i % scale), 0.5f + 1.5f * (i / (scale * scale)), 0.0f - 1.5f * ((i % (scale * scale)) / scale), 0.5f);
+}
+
+// Primary rays from the default camera at distance 10
+void buildRays(std::vector<float>& directions)
+{
+    directions.resize(BENCH_WIDTH * BENCH_HEIGHT * 3);
+    for(int y = 0; y < BENCH_HEIGHT; y++)
+        for(int x = 0; x < BENCH_WIDTH; x++) {
+            float u = ((x + 0.5f) / BENCH_WIDTH - 0.5f) * BENCH_WIDTH / BENCH_HEIGHT;
+            float v = (y + 0.5f) / BENCH_HEIGHT - 0.5f;
+            float n = std::sqrt(u * u + v * v + 1.0f);
+            float* d = &directions[(y * BENCH_WIDTH + x) * 3];
+            d[0] = u / n;
+            d[1] = v / n;
+            d[2] = -1.0f / n;
+        }
+}
+
+int main()
+{
+    const float origin[3] = {0.0f, 4.0f, 10.0f};
+    std::vector<float> directions;
+    buildRays(directions);
+    int rays = BENCH_WIDTH * BENCH_HEIGHT;
+
+    std::cout << "Kernels:";
+    for(int k = 0; k < KERNEL_COUNT; k++)
+        std::cout << " " << kernelNames[k] << (KernelSupported(k) && GetKernel(k) ? "" : " (unsupported)");
+    std::cout << std::endl << "Dispatch picks " << kernelNames[BestKernel()] << std::endl << std::endl;
+
+    FILE *df = fopen("IntersectBench.txt", "w");
+    fprintf(df, "Spheres\tKernel\tIntersections Per Second\tSpeedup\tMismatches\n");
+
+    SphereSoA spheres;
+    std::vector<KernelHit> reference(rays);
+    for(size_t n = 0; n < sizeof(numbers) / sizeof(numbers[0]); n++) {
+        buildSpheres(numbers[n], spheres);
+        double scalarRate = 0.0;
+        for(int k = 0; k < KERNEL_COUNT; k++) {
+            NearestSphereFn kernel = GetKernel(k);
+            if(!kernel || !KernelSupported(k))
+                continue;
+
+            // Repeat the whole set of rays until enough time has passed
+            int mismatches = 0;
+            long passes = 0;
+            volatile int sink = 0;
+            double start = getTime(), elapsed = 0.0;
+            do {
+                for(int r = 0; r < rays; r++) {
+                    KernelHit hit = kernel(spheres, origin, &directions[r * 3]);
+                    sink += hit.index;
+                    if(passes == 0) {
+                        if(k == KERNEL_SCALAR)
+                            reference[r] = hit;
+                        else if(hit.index != reference[r].index || std::fabs(hit.len - reference[r].len) > 1e-4f * reference[r].len)
+                            mismatches++;
+                    }
+                }
+                passes++;
+                elapsed = getTime() - start;
+            } while(elapsed < BENCH_SECONDS);
+
+            double rate = double(rays) * passes * numbers[n] / elapsed;
+            if(k == KERNEL_SCALAR)
+                scalarRate = rate;
+            fprintf(df, "%d\t%s\t%f\t%f\t%d\n", numbers[n], kernelNames[k], rate, rate / scalarRate, mismatches);
+            printf("%7d spheres  %-8s %12.0f intersections/s  %6.2fx scalar  %d mismatches\n",
+                   numbers[n], kernelNames[k], rate, rate / scalarRate, mismatches);
+        }
+    }
+    fclose(df);
+    return 0;
+}
@@ -0,0 +1,243 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <cmath>
+
+// SIMD Includes. Every kernel is compiled with its own target attribute, so the file builds without -mavx2 or
+// -mavx512f and the right kernel is picked at run time.
+#if defined(__x86_64__) || defined(__i386__)
+#define INTERSECT_X86
+#include <immintrin.h>
+#endif
+
+// Nearest hit of one ray against many spheres, the same test as intersect(Ray, Sphere) and testSphere() in
+// first_pass.frag: spheres behind the ray origin are skipped, the far root is used when the origin is inside.
+// The direction must be normalized. Spheres are stored as a structure of arrays so that one vector register holds
+// 4, 8 or 16 spheres.
+
+// Kernels in order of width, Intersect_Kernel values index kernelNames
+enum Intersect_Kernel {
+    KERNEL_SCALAR,
+    KERNEL_SSE,
+    KERNEL_AVX2,
+    KERNEL_AVX512,
+    KERNEL_COUNT
+};
+const char* const kernelNames[] = {"Scalar", "SSE", "AVX2", "AVX-512"};
+
+const float KERNEL_MAX_LEN = 2147483647.0f;  // Same miss distance as the shader
+const int KERNEL_PADDING = 16;              // Widest kernel, the arrays are padded to a multiple of it
+
+// Sphere centers and squared radii, padded with spheres that can never be hit
+struct SphereSoA {
+    std::vector<float> x, y, z, r2;
+    int Count;
+
+    SphereSoA() : Count(0) {}
+
+    void Resize(int count)
+    {
+        int padded = (count + KERNEL_PADDING - 1) / KERNEL_PADDING * KERNEL_PADDING;
+        this->Count = count;
+        this->x.assign(padded, 0.0f);
+        this->y.assign(padded, 0.0f);
+        this->z.assign(padded, 0.0f);
+        this->r2.assign(padded, -1.0f); // A negative squared radius always gives a negative determinant
+    }
+
+    void Set(int i, float cx, float cy, float cz, float radius)
+    {
+        this->x[i] = cx;
+        this->y[i] = cy;
+        this->z[i] = cz;
+        this->r2[i] = radius * radius;
+    }
+
+    // Number of entries including the padding
+    int Padded() const { return (int)this->x.size(); }
+};
+
+// Closest hit distance and sphere index, KERNEL_MAX_LEN and -1 when nothing is hit
+struct KernelHit {
+    float len;
+    int index;
+};
+
+typedef KernelHit (*NearestSphereFn)(const SphereSoA& spheres, const float origin[3], const float direction[3]);
+
+inline KernelHit nearestSphereScalar(const SphereSoA& s, const float o[3], const float d[3])
+{
+    KernelHit hit = {KERNEL_MAX_LEN, -1};
+    for(int i = 0; i < s.Count; i++) {
+        float ocx = s.x[i] - o[0], ocy = s.y[i] - o[1], ocz = s.z[i] - o[2];
+        float l = d[0] * ocx + d[1] * ocy + d[2] * ocz;
+        if(l < 0.0f) continue; // Behind the ray origin
+        float det = l * l - (ocx * ocx + ocy * ocy + ocz * ocz) + s.r2[i];
+        if(det < 0.0f) continue;
+        float root = std::sqrt(det);
+        float len = l - root;
+        if(len < 0.0f) len = l + root;
+        if(len < hit.len) {
+            hit.len = len;
+            hit.index = i;
+        }
+    }
+    return hit;
+}
+
+#ifdef INTERSECT_X86
+
+// Picks the closest of the per-lane results, the lowest index wins a tie like in the scalar loop
+inline KernelHit reduceLanes(const float* len, const int* index, int lanes)
+{
+    KernelHit hit = {KERNEL_MAX_LEN, -1};
+    for(int i = 0; i < lanes; i++)
+        if(index[i] >= 0 && (len[i] < hit.len || (len[i] == hit.len && index[i] < hit.index))) {
+            hit.len = len[i];
+            hit.index = index[i];
+        }
+    return hit;
+}
+
+__attribute__((target("sse2")))
+inline KernelHit nearestSphereSSE(const SphereSoA& s, const float o[3], const float d[3])
+{
+    const __m128 ox = _mm_set1_ps(o[0]), oy = _mm_set1_ps(o[1]), oz = _mm_set1_ps(o[2]);
+    const __m128 dx = _mm_set1_ps(d[0]), dy = _mm_set1_ps(d[1]), dz = _mm_set1_ps(d[2]);
+    const __m128 zero = _mm_setzero_ps();
+    __m128 best = _mm_set1_ps(KERNEL_MAX_LEN);
+    __m128i bestIndex = _mm_set1_epi32(-1);
+    __m128i index = _mm_setr_epi32(0, 1, 2, 3);
+    const __m128i step = _mm_set1_epi32(4);
+    for(int i = 0; i < s.Count; i += 4) {
+        __m128 ocx = _mm_sub_ps(_mm_loadu_ps(&s.x[i]), ox);
+        __m128 ocy = _mm_sub_ps(_mm_loadu_ps(&s.y[i]), oy);
+        __m128 ocz = _mm_sub_ps(_mm_loadu_ps(&s.z[i]), oz);
+        __m128 l = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ocx), _mm_mul_ps(dy, ocy)), _mm_mul_ps(dz, ocz));
+        __m128 oc2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ocx, ocx), _mm_mul_ps(ocy, ocy)), _mm_mul_ps(ocz, ocz));
+        __m128 det = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(l, l), oc2), _mm_loadu_ps(&s.r2[i]));
+        __m128 root = _mm_sqrt_ps(_mm_max_ps(det, zero));
+        __m128 nearLen = _mm_sub_ps(l, root);
+        __m128 inside = _mm_cmplt_ps(nearLen, zero);
+        __m128 len = _mm_or_ps(_mm_and_ps(inside, _mm_add_ps(l, root)), _mm_andnot_ps(inside, nearLen));
+        __m128 hit = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(l, zero), _mm_cmpge_ps(det, zero)), _mm_cmplt_ps(len, best));
+        best = _mm_or_ps(_mm_and_ps(hit, len), _mm_andnot_ps(hit, best));
+        __m128i hitMask = _mm_castps_si128(hit);
+        bestIndex = _mm_or_si128(_mm_and_si128(hitMask, index), _mm_andnot_si128(hitMask, bestIndex));
+        index = _mm_add_epi32(index, step);
+    }
+    float lens[4];
+    int indices[4];
+    _mm_storeu_ps(lens, best);
+    _mm_storeu_si128((__m128i*)indices, bestIndex);
+    return reduceLanes(lens, indices, 4);
+}
+
+__attribute__((target("avx2")))
+inline KernelHit nearestSphereAVX2(const SphereSoA& s, const float o[3], const float d[3])
+{
+    const __m256 ox = _mm256_set1_ps(o[0]), oy = _mm256_set1_ps(o[1]), oz = _mm256_set1_ps(o[2]);
+    const __m256 dx = _mm256_set1_ps(d[0]), dy = _mm256_set1_ps(d[1]), dz = _mm256_set1_ps(d[2]);
+    const __m256 zero = _mm256_setzero_ps();
+    __m256 best = _mm256_set1_ps(KERNEL_MAX_LEN);
+    __m256i bestIndex = _mm256_set1_epi32(-1);
+    __m256i index = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i step = _mm256_set1_epi32(8);
+    for(int i = 0; i < s.Count; i += 8) {
+        __m256 ocx = _mm256_sub_ps(_mm256_loadu_ps(&s.x[i]), ox);
+        __m256 ocy = _mm256_sub_ps(_mm256_loadu_ps(&s.y[i]), oy);
+        __m256 ocz = _mm256_sub_ps(_mm256_loadu_ps(&s.z[i]), oz);
+        __m256 l = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, ocx), _mm256_mul_ps(dy, ocy)), _mm256_mul_ps(dz, ocz));
+        __m256 oc2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ocx, ocx), _mm256_mul_ps(ocy, ocy)), _mm256_mul_ps(ocz, ocz));
+        __m256 det = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(l, l), oc2), _mm256_loadu_ps(&s.r2[i]));
+        __m256 root = _mm256_sqrt_ps(_mm256_max_ps(det, zero));
+        __m256 nearLen = _mm256_sub_ps(l, root);
+        __m256 len = _mm256_blendv_ps(nearLen, _mm256_add_ps(l, root), _mm256_cmp_ps(nearLen, zero, _CMP_LT_OQ));
+        __m256 hit = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(l, zero, _CMP_GE_OQ), _mm256_cmp_ps(det, zero, _CMP_GE_OQ)),
+                                   _mm256_cmp_ps(len, best, _CMP_LT_OQ));
+        best = _mm256_blendv_ps(best, len, hit);
+        bestIndex = _mm256_blendv_epi8(bestIndex, index, _mm256_castps_si256(hit));
+        index = _mm256_add_epi32(index, step);
+    }
+    float lens[8];
+    int indices[8];
+    _mm256_storeu_ps(lens, best);
+    _mm256_storeu_si256((__m256i*)indices, bestIndex);
+    return reduceLanes(lens, indices, 8);
+}
+
+__attribute__((target("avx512f")))
+inline KernelHit nearestSphereAVX512(const SphereSoA& s, const float o[3], const float d[3])
+{
+    const __m512 ox = _mm512_set1_ps(o[0]), oy = _mm512_set1_ps(o[1]), oz = _mm512_set1_ps(o[2]);
+    const __m512 dx = _mm512_set1_ps(d[0]), dy = _mm512_set1_ps(d[1]), dz = _mm512_set1_ps(d[2]);
+    const __m512 zero = _mm512_setzero_ps();
+    __m512 best = _mm512_set1_ps(KERNEL_MAX_LEN);
+    __m512i bestIndex = _mm512_set1_epi32(-1);
+    __m512i index = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i step = _mm512_set1_epi32(16);
+    for(int i = 0; i < s.Count; i += 16) {
+        __m512 ocx = _mm512_sub_ps(_mm512_loadu_ps(&s.x[i]), ox);
+        __m512 ocy = _mm512_sub_ps(_mm512_loadu_ps(&s.y[i]), oy);
+        __m512 ocz = _mm512_sub_ps(_mm512_loadu_ps(&s.z[i]), oz);
+        __m512 l = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(dx, ocx), _mm512_mul_ps(dy, ocy)), _mm512_mul_ps(dz, ocz));
+        __m512 oc2 = _mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(ocx, ocx), _mm512_mul_ps(ocy, ocy)), _mm512_mul_ps(ocz, ocz));
+        __m512 det = _mm512_add_ps(_mm512_sub_ps(_mm512_mul_ps(l, l), oc2), _mm512_loadu_ps(&s.r2[i]));
+        __mmask16 valid = _mm512_cmp_ps_mask(l, zero, _CMP_GE_OQ) & _mm512_cmp_ps_mask(det, zero, _CMP_GE_OQ);
+        __m512 root = _mm512_maskz_sqrt_ps(valid, det);
+        __m512 nearLen = _mm512_sub_ps(l, root);
+        __m512 len = _mm512_mask_blend_ps(_mm512_cmp_ps_mask(nearLen, zero, _CMP_LT_OQ), nearLen, _mm512_add_ps(l, root));
+        __mmask16 hit = valid & _mm512_cmp_ps_mask(len, best, _CMP_LT_OQ);
+        best = _mm512_mask_blend_ps(hit, best, len);
+        bestIndex = _mm512_mask_blend_epi32(hit, bestIndex, index);
+        index = _mm512_add_epi32(index, step);
+    }
+    float lens[16];
+    int indices[16];
+    _mm512_storeu_ps(lens, best);
+    _mm512_storeu_si512(indices, bestIndex);
+    return reduceLanes(lens, indices, 16);
+}
+
+#endif
+
+// Whether this CPU can run the kernel
+inline bool KernelSupported(int kernel)
+{
+    if(kernel == KERNEL_SCALAR)
+        return true;
+#ifdef INTERSECT_X86
+    __builtin_cpu_init();
+    if(kernel == KERNEL_SSE)
+        return __builtin_cpu_supports("sse2");
+    if(kernel == KERNEL_AVX2)
+        return __builtin_cpu_supports("avx2");
+    if(kernel == KERNEL_AVX512)
+        return __builtin_cpu_supports("avx512f");
+#endif
+    return false;
+}
+
+// The kernel function, or NULL if it is not compiled in for this architecture
+inline NearestSphereFn GetKernel(int kernel)
+{
+    switch(kernel) {
+        case KERNEL_SCALAR: return nearestSphereScalar;
+#ifdef INTERSECT_X86
+        case KERNEL_SSE:    return nearestSphereSSE;
+        case KERNEL_AVX2:   return nearestSphereAVX2;
+        case KERNEL_AVX512: return nearestSphereAVX512;
+#endif
+        default:            return NULL;
+    }
+}
+
+// Widest kernel this CPU supports
+inline int BestKernel()
+{
+    for(int k = KERNEL_COUNT - 1; k > KERNEL_SCALAR; k--)
+        if(KernelSupported(k) && GetKernel(k))
+            return k;
+    return KERNEL_SCALAR;
+}
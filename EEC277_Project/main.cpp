@@ -1,9 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
 #include <iostream>
 #include <cmath>
 #include <string>
 #include <array>
+#include <vector>
+#include <chrono>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <signal.h>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -16,6 +26,23 @@
 
 #include "shader.h"
 #include "camera.h"
+#include "headless.h"
+#include "scene.h"
+#include "bvh.h"
+#include "grid.h"
+#include "raystats.h"
+#include "readback.h"
+#include "cpu_renderer.h"
+#include "timing.h"
+#include "wavefront.h"
+#include "tiles.h"
+#include "scene_file.h"
+#include "matrix.h"
+#include "camera_path.h"
+#include "image_writer.h"
+#include "cost_profile.h"
+#include "screen_bins.h"
+#include "distributed.h"
 
 // Correctly set resolution for Macbook Retina
 #ifdef __APPLE__
@@ -24,33 +51,81 @@
 #define MUL 1
 #endif
 
-#define MAX_SPHERE_NUM       339    // Maximum number of spheres allowed under 4096 uniform constrains
 #define MAX_ITERATION_NUM    16
 #define INIT_SPHERE_NUM      125
 #define INIT_ITERATION_NUM   6
 #define INIT_DISTANCE        10.0f
 #define PI                   3.14159
+#define INIT_READBACK_SLOTS  3
+#define INIT_WARMUP_FRAMES   10
+#define INIT_REPEATS         5
+#define INIT_REBUILD_RATIO   1.3f
+
+const char* accelNames[] = {"Linear", "BVH", "Grid"};
+const char* backendNames[] = {"GL", "Wavefront", "CPU"};
+const char* layoutNames[] = {"Table", "Inline"};  // Indexed by TestStruct::inlineMaterials
+
+// Where the frames are rendered
+enum Backend_Type {
+    BACKEND_GL,
+    BACKEND_WAVEFRONT,          // Compute shader queues instead of the first pass, needs OpenGL 4.3
+    BACKEND_CPU
+};
 
 // Define a struct storing test parameters
 typedef struct {
     int nums;
     int iterations;
+    int accel;
+    int readbackSlots;          // Pixel pack buffers in the readback ring, 0 reads back synchronously
+    int backend;
+    int threads;                // Worker threads of the CPU backend, 0 uses every hardware thread
+    int warmupFrames;           // Frames rendered before each measurement with a frame count
+    int measuredFrames;         // Frames per measurement, 0 measures 5 second windows of wall clock time
+    int repeats;                // Measurements per configuration with a frame count
+    int progressiveSamples;     // Jittered samples accumulated while nothing moves, 0 traces every frame from scratch
+    double frameBudget;         // Milliseconds of first pass tiles per present, 0 draws the whole frame at once
+    const char* sceneFile;      // Binary scene rendered instead of the sphere lattice, NULL for the lattice
+    float animation;            // Distance the spheres move from their rest position every frame, 0 keeps them still
+    float rebuildRatio;         // An animated BVH is rebuilt once refitting has raised its SAH cost by this factor
+    const char* matrixFile;     // Benchmark matrix, every combination of its axis values is run, NULL for none
+    const char* pathFile;       // Camera path rendered offline to image files, NULL to render interactively
+    const char* outputDir;      // Directory the frames of the camera path are written to
+    int writerThreads;          // Threads encoding the frames of the camera path, 0 uses every hardware thread
+    int localWorkers;           // Worker processes this one spawns to render tiles of the frame, 0 renders it itself
+    int remoteWorkers;          // Workers on other machines the coordinator waits for
+    int distributePort;         // Port the coordinator listens on, 0 picks a free one
+    const char* workerAddress;  // host:port of the coordinator this process renders tiles for, NULL if it is none
     
     bool withPlane;
     bool lightMoving;
     bool canRefract;
     bool turnOffRayCalculation;
+    bool headless;
+    bool specialize;            // Compile the first pass for the scene flags and iteration count instead of reading uniforms
+    bool roulette;              // End paths by Russian roulette instead of the fixed throughput cutoff
+    bool bounceHistogram;       // Record the path length of every pixel and write its histogram per measurement
+    bool heatmap;               // Record the cost of every pixel and write heatmaps and a tile table per measurement
+    bool inlineMaterials;       // Spheres carry their materials and hit records the whole surface, the layout before the material table
+    bool screenBins;            // Primary rays only test the spheres binned to their screen tile
     
     bool doNumberTest;
     bool doIterationTest;
     bool doDistanceTest;
     bool doStandardTest;
+    bool doReadbackTest;
 } TestStruct;
 
 TestStruct testStruct;
 
-// Window dimensions
-const GLuint WIDTH = 1024, HEIGHT = 768;
+// True when running one of the benchmark sweeps
+bool doingTest()
+{
+    return testStruct.doNumberTest || testStruct.doIterationTest || testStruct.doDistanceTest || testStruct.doStandardTest || testStruct.doReadbackTest || testStruct.matrixFile;
+}
+
+// Window dimensions, can be changed with -res
+GLuint WIDTH = 1024, HEIGHT = 768;
 
 // Camera
 Camera  camera(glm::vec3(0.0f, 4.0f, INIT_DISTANCE));
@@ -62,13 +137,45 @@ bool keys[1024];
 GLfloat deltaTime = 0.0f;   // Time between current frame and last frame
 GLfloat lastFrame = 0.0f;   // Time of last frame
 
-// Sphere array
-glm::vec3 sp_pos[MAX_SPHERE_NUM];
+// Seconds since the program started. Replaces glfwGetTime(), which is unavailable when GLFW is not initialized in headless mode
+double getTime()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Peak resident set size of the process in megabytes
+double peakRSS()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / (1024.0 * 1024.0); // Bytes on Mac OS
+#else
+    return usage.ru_maxrss / 1024.0;            // Kilobytes on Linux
+#endif
+}
+
+// Sphere array, uploaded to the sphere buffer whenever the scene changes
+std::vector<Sphere> spheres;
+
+// Scene loaded with -scene, mapped for the whole session
+SceneFile sceneFile;
+
+// Keyframes loaded with -path
+CameraPath cameraPath;
+
+// Distributed rendering: the connection of a worker to its coordinator, and the arguments it received,
+// which outlive parseArgs() because it keeps pointers to file names
+Connection coordinator;
+std::vector<std::string> coordinatorArguments;
 
 // Test parameter arrays
 const int numbers[] = {1, 8, 27, 64, 125, 216};
+const int accelNumbers[] = {1, 8, 27, 64, 125, 216, 1000, 10000, 100000}; // Number test with an acceleration structure
 const int iterations[] = {2, 4, 6, 8, 10, 12, 14, 16};
 const float distances[] = {10.0f, 13.0f, 16.0f, 19.0f, 22.0f, 25.0f, 28.0f, 31.0f};
+const int readbackSlots[] = {0, 1, 2, 3, 4};
 
 const char usageString[] = {"\
 [-n]\tSet number of spheres\n \
@@ -77,10 +184,40 @@ const char usageString[] = {"\
 [-m]\tDisable light movement\n \
 [-r]\tDisable refraction\n \
 [-o]\tTurn off ray rate calculation\n \
+[-accel]\tAcceleration structure: linear, bvh or grid\n \
+[-res]\tSet resolution, e.g. -res 1920x1080\n \
+[-scene]\tRender the spheres of a binary scene file made by scene_convert instead of the lattice\n \
+[-backend]\tRender with gl, wavefront or cpu\n \
+[-threads]\tSet number of CPU backend threads, 0 uses all\n \
+[-rb]\tSet number of readback buffers, 0 reads back synchronously\n \
+[-frames]\tMeasure this many frames with frame-indexed animation instead of 5 seconds\n \
+[-warmup]\tSet number of unmeasured frames before each measurement with -frames\n \
+[-repeat]\tSet number of measurements per configuration with -frames\n \
+[-progressive]\tAccumulate this many jittered samples while camera and light are static, then stop tracing\n \
+[-animate]\tMove every sphere up to this distance around its rest position each frame\n \
+[-rebuild]\tRebuild the BVH of an animated scene once refitting has raised its SAH cost by this factor\n \
+[-roulette]\tEnd paths by Russian roulette on their throughput instead of a fixed cutoff\n \
+[-bounces]\tWrite a histogram of the bounce depth per pixel after every measurement\n \
+[-heatmap]\tWrite heatmaps of rays, sphere tests, bounces and shader clock per pixel and their sums per tile after every measurement\n \
+[-path]\tRender the keyframes of a camera path file offline and write every frame as a PNG file, -frames sets the frame count\n \
+[-out]\tSet the directory the frames of -path are written to\n \
+[-writers]\tSet number of threads encoding the frames of -path, 0 uses all\n \
+[-budget]\tSpread each frame over several presents, drawing this many milliseconds of first pass tiles per present\n \
+[--headless]\tRender offscreen without a window (EGL surfaceless)\n \
+[-distribute]\tSpawn this many local worker processes, render the frame as tiles on 1 to all of them and write the scaling to DistributedTest.txt\n \
+[-remote]\tAlso wait for this many workers started on other machines with -worker\n \
+[-port]\tSet the port the coordinator listens on for -remote workers, 0 picks a free one\n \
+[-worker]\tRender tiles for the coordinator at host:port, with the arguments it sends\n \
+[-generic]\tRead plane, refraction and iterations from uniforms instead of specialized shaders\n \
+[-bin]\tBin the spheres into 16x16 pixel screen tiles when the view changes, primary rays only test those of their tile\n \
+[-layout]\tSet the sphere layout of the first pass: table (positions and a shared material table) or inline (materials in every sphere)\n \
+[-nocache]\tAlways compile shaders from source instead of using the program binaries in shader_cache/\n \
 [-nt]\tDo number test\n \
 [-it]\tDo iteration test\n \
 [-dt]\tDo distance test\n \
-[-st]\tDo standard test\n\n"};
+[-st]\tDo standard test\n \
+[-rbt]\tDo readback test\n \
+[-matrix]\tRun every combination of the axes in a matrix file and write one CSV file, see matrix_example.txt\n\n"};
 
 void usage(const char *progName)
 {
@@ -119,33 +256,308 @@ void parseArgs(int argc, char **argv, TestStruct *testStruct) {
         }
         else if (strcmp(argv[i],"-o") == 0) // Turn off ray calculation
         {
-            if(!(testStruct->doIterationTest || testStruct->doDistanceTest || testStruct->doNumberTest || testStruct->doStandardTest))
+            if(!(testStruct->doIterationTest || testStruct->doDistanceTest || testStruct->doNumberTest || testStruct->doStandardTest || testStruct->doReadbackTest))
                 testStruct->turnOffRayCalculation = true;
         }
+        else if (strcmp(argv[i],"-accel") == 0) // Choose acceleration structure
+        {
+            i++;
+            argc--;
+            if(argc > 0 && strcmp(argv[i],"linear") == 0)
+                testStruct->accel = ACCEL_LINEAR;
+            else if(argc > 0 && strcmp(argv[i],"bvh") == 0)
+                testStruct->accel = ACCEL_BVH;
+            else if(argc > 0 && strcmp(argv[i],"grid") == 0)
+                testStruct->accel = ACCEL_GRID;
+            else {
+                fprintf(stderr,"Unknown acceleration structure, expected linear, bvh or grid\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-res") == 0) // Change resolution
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || sscanf(argv[i], "%ux%u", &WIDTH, &HEIGHT) != 2 || WIDTH == 0 || HEIGHT == 0) {
+                fprintf(stderr,"Invalid resolution, expected WIDTHxHEIGHT\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-backend") == 0) // Choose renderer
+        {
+            i++;
+            argc--;
+            if(argc > 0 && strcmp(argv[i],"gl") == 0)
+                testStruct->backend = BACKEND_GL;
+            else if(argc > 0 && strcmp(argv[i],"wavefront") == 0)
+                testStruct->backend = BACKEND_WAVEFRONT;
+            else if(argc > 0 && strcmp(argv[i],"cpu") == 0)
+                testStruct->backend = BACKEND_CPU;
+            else {
+                fprintf(stderr,"Unknown backend, expected gl, wavefront or cpu\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-threads") == 0) // Change CPU backend thread count
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->threads = atoi(argv[i])) < 0) {
+                fprintf(stderr,"Invalid number of threads\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-rb") == 0) // Change readback ring size
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->readbackSlots = atoi(argv[i])) < 0) {
+                fprintf(stderr,"Invalid number of readback buffers\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-frames") == 0) // Deterministic measurement
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->measuredFrames = atoi(argv[i])) <= 0) {
+                fprintf(stderr,"Invalid number of frames\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-warmup") == 0) // Change warmup frame count
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->warmupFrames = atoi(argv[i])) < 0) {
+                fprintf(stderr,"Invalid number of warmup frames\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-repeat") == 0) // Change repeat count
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->repeats = atoi(argv[i])) <= 0) {
+                fprintf(stderr,"Invalid number of repeats\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-progressive") == 0) // Progressive accumulation
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->progressiveSamples = atoi(argv[i])) <= 0) {
+                fprintf(stderr,"Invalid number of progressive samples\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-scene") == 0) // Binary scene file
+        {
+            i++;
+            argc--;
+            if(argc <= 0) {
+                fprintf(stderr,"Missing scene file\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+            testStruct->sceneFile = argv[i];
+        }
+        else if (strcmp(argv[i],"-animate") == 0) // Moving spheres
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->animation = atof(argv[i])) <= 0.0f) {
+                fprintf(stderr,"Invalid animation distance\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-rebuild") == 0) // Refit quality threshold
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->rebuildRatio = atof(argv[i])) < 1.0f) {
+                fprintf(stderr,"Invalid rebuild ratio, must be at least 1\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-path") == 0) // Offline camera path
+        {
+            i++;
+            argc--;
+            if(argc <= 0) {
+                fprintf(stderr,"Missing camera path file\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+            testStruct->pathFile = argv[i];
+        }
+        else if (strcmp(argv[i],"-out") == 0) // Frame directory
+        {
+            i++;
+            argc--;
+            if(argc <= 0) {
+                fprintf(stderr,"Missing output directory\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+            testStruct->outputDir = argv[i];
+        }
+        else if (strcmp(argv[i],"-writers") == 0) // Change encoder thread count
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->writerThreads = atoi(argv[i])) < 0) {
+                fprintf(stderr,"Invalid number of writer threads\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-roulette") == 0) // Russian roulette path termination
+        {
+            testStruct->roulette = true;
+        }
+        else if (strcmp(argv[i],"-bounces") == 0) // Bounce depth histogram
+        {
+            testStruct->bounceHistogram = true;
+        }
+        else if (strcmp(argv[i],"-heatmap") == 0) // Per-pixel cost profile
+        {
+            testStruct->heatmap = true;
+        }
+        else if (strcmp(argv[i],"-bin") == 0) // Screen tile binning of primary rays
+        {
+            testStruct->screenBins = true;
+        }
+        else if (strcmp(argv[i],"-layout") == 0) // Sphere layout of the first pass
+        {
+            i++;
+            argc--;
+            if(argc > 0 && strcmp(argv[i],"table") == 0)
+                testStruct->inlineMaterials = false;
+            else if(argc > 0 && strcmp(argv[i],"inline") == 0)
+                testStruct->inlineMaterials = true;
+            else {
+                fprintf(stderr,"Unknown sphere layout, expected table or inline\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-budget") == 0) // Tiled first pass with a time budget per present
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->frameBudget = atof(argv[i])) <= 0.0) {
+                fprintf(stderr,"Invalid frame budget\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-distribute") == 0) // Coordinator with local workers
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->localWorkers = atoi(argv[i])) < 0) {
+                fprintf(stderr,"Invalid number of local workers\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-remote") == 0) // Coordinator with workers on other machines
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->remoteWorkers = atoi(argv[i])) < 0) {
+                fprintf(stderr,"Invalid number of remote workers\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-port") == 0) // Coordinator port
+        {
+            i++;
+            argc--;
+            if(argc <= 0 || (testStruct->distributePort = atoi(argv[i])) < 0 || testStruct->distributePort > 65535) {
+                fprintf(stderr,"Invalid port\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+        }
+        else if (strcmp(argv[i],"-worker") == 0) // Tile worker of a coordinator
+        {
+            i++;
+            argc--;
+            if(argc <= 0) {
+                fprintf(stderr,"Missing coordinator address\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+            testStruct->workerAddress = argv[i];
+        }
+        else if (strcmp(argv[i],"--headless") == 0) // Offscreen rendering
+        {
+            testStruct->headless = true;
+        }
+        else if (strcmp(argv[i],"-generic") == 0) // No shader specialization
+        {
+            testStruct->specialize = false;
+        }
+        else if (strcmp(argv[i],"-nocache") == 0) // No program binary cache
+        {
+            Shader::CacheDirectory() = "";
+        }
         else if (strcmp(argv[i],"-nt") == 0) // Do number testing
         {
             // Do one test at a time
-            if(!testStruct->doIterationTest && !testStruct->doDistanceTest && !testStruct->doStandardTest)
+            if(!testStruct->doIterationTest && !testStruct->doDistanceTest && !testStruct->doStandardTest && !testStruct->doReadbackTest)
                 testStruct->doNumberTest = true;
         }
         else if (strcmp(argv[i],"-it") == 0) // Do iteration testing
         {
             // Do one test at a time
-            if(!testStruct->doNumberTest && !testStruct->doDistanceTest && !testStruct->doStandardTest)
+            if(!testStruct->doNumberTest && !testStruct->doDistanceTest && !testStruct->doStandardTest && !testStruct->doReadbackTest)
                 testStruct->doIterationTest = true;
         }
         else if (strcmp(argv[i],"-dt") == 0) // Do distance testing
         {
             // Do one test at a time
-            if(!testStruct->doNumberTest && !testStruct->doIterationTest && !testStruct->doStandardTest)
+            if(!testStruct->doNumberTest && !testStruct->doIterationTest && !testStruct->doStandardTest && !testStruct->doReadbackTest)
                 testStruct->doDistanceTest = true;
         }
         else if (strcmp(argv[i],"-st") == 0) // Do standard testing
         {
             // Do one test at a time
-            if(!testStruct->doNumberTest && !testStruct->doIterationTest && !testStruct->doDistanceTest)
+            if(!testStruct->doNumberTest && !testStruct->doIterationTest && !testStruct->doDistanceTest && !testStruct->doReadbackTest)
                 testStruct->doStandardTest = true;
         }
+        else if (strcmp(argv[i],"-rbt") == 0) // Do readback testing
+        {
+            // Do one test at a time
+            if(!testStruct->doNumberTest && !testStruct->doIterationTest && !testStruct->doDistanceTest && !testStruct->doStandardTest)
+                testStruct->doReadbackTest = true;
+        }
+        else if (strcmp(argv[i],"-matrix") == 0) // Benchmark matrix
+        {
+            i++;
+            argc--;
+            if(argc <= 0) {
+                fprintf(stderr,"Missing matrix file\n");
+                usage(argv[0]);
+                exit(-1);
+            }
+            testStruct->matrixFile = argv[i];
+        }
         else
         {
             fprintf(stderr,"Unrecognized argument: %s \n", argv[i]);
@@ -208,73 +620,1205 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
     camera.ProcessMouseScroll(yoffset);
 }
 
-int main(int argc, char **argv)
+// One configuration of a sweep. Resolution and camera distance live outside TestStruct, so the cell carries them too.
+typedef struct {
+    TestStruct test;
+    GLuint width, height;
+    float distance;
+    bool baseline;              // Only measured as the reference of the next cell, which writes the row
+} SweepCell;
+
+// Benchmark sweep state, shared by the GL and CPU backends. Every test is a list of cells run in order,
+// without a test the list holds the one configuration set by the arguments.
+std::vector<SweepCell> cells;
+BenchmarkMatrix matrix;
+
+// With an acceleration structure the number test goes up to 100k spheres and runs every
+// sphere count twice, first with the linear loop, to report the speedup and crossover point
+bool compareLinear = false;
+int crossover = -1;
+
+// With specialization the standard test runs every configuration twice, first with the generic first pass
+// that reads the flags from uniforms, to report the speedup of each specialized variant
+bool compareGeneric = false;
+
+// Frame rate of the last baseline cell, the linear loop or the generic first pass
+bool measuringBaseline = false;
+float baselineFps = 0.0f;
+
+// Readback test: frame rate with synchronous readback, the speedup of each ring size is relative to it
+float syncFps = 0.0f;
+
+FILE *df = NULL;
+FILE *ff = NULL;    // Per-frame samples of every run
+FILE *bf = NULL;    // Bounce depth histogram of every run
+FILE *hf = NULL;    // Cost of every screen tile of every run
+std::string resultName;     // Result file name without extension, heatmap images of a test start with it
+bool shaderClock = false;   // The first pass can read ARB_shader_clock, otherwise the clock channel stays 0
+double binListLength = 0.0;  // Mean spheres per screen tile of the last binning of this run
+double binTime = 0.0;        // Milliseconds
+GLint firstPassBytes = 0;   // Program binary size of the first pass variant of this run, the closest to its register use GL reports
+int runIndex = 0;
+
+// Acceleration structures are built once per scene on the CPU
+BVH bvh;
+UniformGrid grid;
+double buildTime = 0.0; // Milliseconds
+std::string gridResolution = "-";
+
+// Animated scenes: where every sphere rests and the SAH cost of the BVH right after its last build
+std::vector<glm::vec3> restPositions;
+float builtCost = 0.0f;
+
+// Index of a name in a list, ignoring case, or -1
+int findName(const std::string& name, const char* const names[], int count)
 {
-    // Init GLFW
-    glfwInit();
-    // Set all the required options for GLFW
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-    
-    // Create a GLFWwindow object that we can use for GLFW's functions
-    GLFWwindow* window = glfwCreateWindow(WIDTH, HEIGHT, "Ray Tracing", nullptr, nullptr);
-    if(!window) {
-        fprintf(stderr, "Failed to create GLFW window.\n");
-        glfwTerminate();
-        exit(EXIT_FAILURE);
+    for(int i = 0; i < count; i++)
+        if(strcasecmp(name.c_str(), names[i]) == 0)
+            return i;
+    return -1;
+}
+
+// Sets one axis of a matrix cell. Returns false for an unknown axis or an invalid value.
+bool applyAxis(SweepCell& cell, const std::string& name, const std::string& value)
+{
+    TestStruct& test = cell.test;
+    if(name == "spheres")
+        return (test.nums = atoi(value.c_str())) > 0;
+    if(name == "iterations")
+        return (test.iterations = atoi(value.c_str())) > 0;
+    if(name == "distance")
+        return (cell.distance = atof(value.c_str())) > 0.0f;
+    if(name == "res")
+        return sscanf(value.c_str(), "%ux%u", &cell.width, &cell.height) == 2 && cell.width > 0 && cell.height > 0;
+    if(name == "plane" || name == "refract" || name == "light") {
+        bool& flag = name == "plane" ? test.withPlane : name == "refract" ? test.canRefract : test.lightMoving;
+        flag = value == "on";
+        return value == "on" || value == "off";
     }
-    glfwMakeContextCurrent(window);
-    
-    // Set the required callback functions
-    glfwSetKeyCallback(window, key_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
-    
-    // GLFW Options
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    
-    // Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
-    glewExperimental = GL_TRUE;
-    // Initialize GLEW to setup the OpenGL Function pointers
-    glewInit();
+    if(name == "accel")
+        return (test.accel = findName(value, accelNames, 3)) >= 0;
+    if(name == "backend")
+        return (test.backend = findName(value, backendNames, 3)) >= 0;
+    if(name == "layout") {
+        int layout = findName(value, layoutNames, 2);
+        test.inlineMaterials = layout == 1;
+        return layout >= 0;
+    }
+    return false;
+}
 
-    // Initialize parameters and parse arguments
-    testStruct.nums = INIT_SPHERE_NUM;
-    testStruct.iterations = INIT_ITERATION_NUM;
-    testStruct.withPlane = true;
-    testStruct.lightMoving = true;
-    testStruct.canRefract = true;
-    testStruct.turnOffRayCalculation = false;
-    testStruct.doNumberTest = false;
-    testStruct.doDistanceTest = false;
-    testStruct.doIterationTest = false;
-    testStruct.doStandardTest = false;
-    
-    parseArgs(argc, argv, &testStruct);
+// Lists the configurations of the chosen test. The compared configurations of the number and standard test
+// each get a baseline cell before them.
+void buildCells()
+{
+    SweepCell cell;
+    cell.test = testStruct;
+    cell.width = WIDTH;
+    cell.height = HEIGHT;
+    cell.distance = camera.Position.z;
+    cell.baseline = false;
     
-    int num_of_test = 0;
+    if(testStruct.matrixFile) {
+        for(size_t i = 0; i < matrix.Size(); i++) {
+            SweepCell matrixCell = cell;
+            for(size_t a = 0; a < matrix.Axes.size(); a++)
+                if(!applyAxis(matrixCell, matrix.Axes[a].Name, matrix.Value(i, a))) {
+                    fprintf(stderr, "Invalid value %s of matrix axis %s. Axes are spheres, iterations, distance, res (WxH), "
+                            "plane, refract and light (on or off), accel (linear, bvh or grid), backend (gl, wavefront or cpu) and layout (table or inline).\n",
+                            matrix.Value(i, a).c_str(), matrix.Axes[a].Name.c_str());
+                    exit(EXIT_FAILURE);
+                }
+            cells.push_back(matrixCell);
+        }
+    }
+    else if(testStruct.doNumberTest) {
+        const int* numberList = compareLinear ? accelNumbers : numbers;
+        int numberCount = compareLinear ? sizeof(accelNumbers) / sizeof(accelNumbers[0]) : sizeof(numbers) / sizeof(numbers[0]);
+        for(int i = 0; i < numberCount; i++) {
+            cell.test.nums = numberList[i];
+            if(compareLinear) {
+                SweepCell linear = cell;
+                linear.test.accel = ACCEL_LINEAR;
+                linear.baseline = true;
+                cells.push_back(linear);
+            }
+            cells.push_back(cell);
+        }
+    }
+    else if(testStruct.doIterationTest) {
+        for(int i = 0; i < 8; i++) {
+            cell.test.iterations = iterations[i];
+            cells.push_back(cell);
+        }
+    }
+    else if(testStruct.doDistanceTest) {
+        for(int i = 0; i < 8; i++) {
+            cell.distance = distances[i];
+            cells.push_back(cell);
+        }
+    }
+    else if(testStruct.doReadbackTest) {
+        for(int i = 0; i < int(sizeof(readbackSlots) / sizeof(readbackSlots[0])); i++) {
+            cell.test.readbackSlots = readbackSlots[i];
+            cells.push_back(cell);
+        }
+    }
+    else if(testStruct.doStandardTest) {
+        for(int i = 0; i < 6; i++) {
+            switch(i) {
+                case 1:
+                    cell.test.withPlane = false; // Test without plane
+                    break;
+                case 2:
+                    cell.test.withPlane = true;
+                    cell.test.lightMoving = false; // Test without moving light
+                    break;
+                case 3:
+                    cell.test.lightMoving = true;
+                    cell.test.canRefract = false; // Test without refraction
+                    break;
+                case 4:
+                    cell.test.canRefract = true;
+                    cell.test.turnOffRayCalculation = true; // Test without calculating ray counts
+                    break;
+                case 5:
+                    cell.test.withPlane = false;
+                    cell.test.lightMoving = false;
+                    cell.test.canRefract = false; // Disable all features
+                    break;
+                default:
+                    break;
+            }
+            if(compareGeneric) {
+                SweepCell generic = cell;
+                generic.test.specialize = false;
+                generic.baseline = true;
+                cells.push_back(generic);
+            }
+            cells.push_back(cell);
+        }
+    }
+    else
+        cells.push_back(cell);
+}
+
+// Makes a cell the configuration of the next run
+void applyCell(const SweepCell& cell)
+{
+    testStruct = cell.test;
+    WIDTH = cell.width;
+    HEIGHT = cell.height;
+    camera.Position.z = cell.distance;
+    measuringBaseline = cell.baseline;
+}
+
+// True if any cell of the sweep renders with this backend
+bool sweepUses(int backend)
+{
+    for(size_t i = 0; i < cells.size(); i++)
+        if(cells[i].test.backend == backend)
+            return true;
+    return false;
+}
+
+// Checks the parameters and lists the configurations of the chosen test
+void initTests()
+{
+    compareLinear = testStruct.doNumberTest && testStruct.accel != ACCEL_LINEAR;
+    compareGeneric = testStruct.doStandardTest && testStruct.specialize && testStruct.backend == BACKEND_GL;
     
-    if(testStruct.nums > MAX_SPHERE_NUM) { // Check if sphere number exceeds limit
-        fprintf(stderr, "Too many spheres!\n");
+    if(testStruct.matrixFile && (testStruct.doNumberTest || testStruct.doIterationTest || testStruct.doDistanceTest || testStruct.doStandardTest || testStruct.doReadbackTest)) {
+        fprintf(stderr, "A matrix file is its own test, it cannot be combined with another one.\n");
+        exit(EXIT_FAILURE);
+    }
+    if(testStruct.matrixFile && !matrix.Load(testStruct.matrixFile))
+        exit(EXIT_FAILURE);
+    if(testStruct.sceneFile && (testStruct.doNumberTest || matrix.Has("spheres"))) {
+        fprintf(stderr, "The number test and a spheres axis place their own spheres, they cannot use a scene file.\n");
+        exit(EXIT_FAILURE);
+    }
+    if(testStruct.pathFile && doingTest()) {
+        fprintf(stderr, "A camera path is rendered to files, it cannot be combined with a test.\n");
+        exit(EXIT_FAILURE);
+    }
+    if(testStruct.pathFile && (testStruct.progressiveSamples > 0 || testStruct.frameBudget > 0.0)) {
+        fprintf(stderr, "A camera path renders whole frames, it cannot be combined with -progressive or -budget.\n");
+        exit(EXIT_FAILURE);
+    }
+    if((testStruct.localWorkers > 0 || testStruct.remoteWorkers > 0) && (doingTest() || testStruct.pathFile)) {
+        fprintf(stderr, "Distributed rendering is its own test, it cannot be combined with another one or a camera path.\n");
         exit(EXIT_FAILURE);
     }
-    if(testStruct.iterations > MAX_ITERATION_NUM) { // Check if sphere number exceeds limit
-        fprintf(stderr, "Too many iterations!\n");
+    if((testStruct.localWorkers > 0 || testStruct.remoteWorkers > 0) && (testStruct.backend != BACKEND_GL || testStruct.progressiveSamples > 0
+        || testStruct.frameBudget > 0.0 || testStruct.animation > 0.0f || testStruct.bounceHistogram || testStruct.heatmap)) {
+        fprintf(stderr, "Distributed rendering draws still frames in tiles on the GL backend, it cannot be combined with -progressive, -budget, -animate, -bounces or -heatmap.\n");
         exit(EXIT_FAILURE);
     }
+    if(testStruct.pathFile && !cameraPath.Load(testStruct.pathFile))
+        exit(EXIT_FAILURE);
+    if(testStruct.sceneFile) {
+        if(!sceneFile.Open(testStruct.sceneFile))
+            exit(EXIT_FAILURE);
+        testStruct.nums = sceneFile.Count;
+        std::cout << "Mapped " << sceneFile.Count << " spheres from " << testStruct.sceneFile << " in " << sceneFile.LoadMs << " ms" << std::endl;
+    }
+    buildCells();
     
-    if(testStruct.doNumberTest) {
-        testStruct.nums = numbers[num_of_test];
+    // Every cell must be possible on its own backend
+    for(size_t i = 0; i < cells.size(); i++) {
+        const TestStruct& test = cells[i].test;
+        if(test.iterations > MAX_ITERATION_NUM) { // Check if sphere number exceeds limit
+            fprintf(stderr, "Too many iterations!\n");
+            exit(EXIT_FAILURE);
+        }
+        if(test.progressiveSamples > 0 && test.backend != BACKEND_GL) {
+            fprintf(stderr, "Progressive rendering needs the GL backend.\n");
+            exit(EXIT_FAILURE);
+        }
+        if((test.roulette || test.bounceHistogram || test.heatmap) && test.backend != BACKEND_GL) {
+            fprintf(stderr, "Russian roulette, the bounce histogram and heatmaps need the GL backend.\n");
+            exit(EXIT_FAILURE);
+        }
+        if(test.screenBins && test.backend != BACKEND_GL) {
+            fprintf(stderr, "Screen tile binning needs the GL backend.\n");
+            exit(EXIT_FAILURE);
+        }
+        if(test.inlineMaterials && test.backend != BACKEND_GL) {
+            fprintf(stderr, "The inline sphere layout is a first pass variant and needs the GL backend.\n");
+            exit(EXIT_FAILURE);
+        }
+        if(test.frameBudget > 0.0 && test.backend != BACKEND_GL) {
+            fprintf(stderr, "A frame budget needs the GL backend.\n");
+            exit(EXIT_FAILURE);
+        }
+        if((test.doReadbackTest || test.pathFile) && test.backend == BACKEND_CPU) {
+            fprintf(stderr, "The readback test and camera paths need a GPU backend.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+// Opens the result file of the chosen test and writes the header. renderer and driver describe the GL context, NULL without one.
+void openResultFile(const char* renderer, const char* driver)
+{
+    std::string filename = "";
+    if(testStruct.matrixFile) {
+        // Results go next to the matrix file, with its extension replaced
+        filename = testStruct.matrixFile;
+        size_t dot = filename.rfind('.'), slash = filename.rfind('/');
+        if(dot != std::string::npos && (slash == std::string::npos || dot > slash))
+            filename.erase(dot);
     }
+    else if(testStruct.doNumberTest)
+        filename += compareLinear ? std::string("NumberTest_") + accelNames[testStruct.accel] : std::string("NumberTest");
+    else if(testStruct.doIterationTest)
+        filename += "IterationTest";
+    else if(testStruct.doDistanceTest)
+        filename += "DistanceTest";
+    else if(testStruct.doStandardTest)
+        filename += "Standard";
+    else if(testStruct.doReadbackTest)
+        filename += "ReadbackTest";
+
+    // A matrix varies these itself, its cells are told apart by columns
+    if(!testStruct.matrixFile && !testStruct.doNumberTest && testStruct.nums != INIT_SPHERE_NUM)
+        filename += "_" + std::to_string(testStruct.nums);
+    if(!testStruct.matrixFile && !testStruct.canRefract)
+        filename += "_NR";
+    if(!testStruct.matrixFile && testStruct.backend == BACKEND_WAVEFRONT)
+        filename += "_Wavefront";
+    if(!testStruct.matrixFile && testStruct.backend == BACKEND_CPU)
+        filename += "_CPU";
+    if(testStruct.roulette)
+        filename += "_Roulette";
+    if(!testStruct.matrixFile && testStruct.screenBins)
+        filename += "_Binned";
+    if(!testStruct.matrixFile && testStruct.inlineMaterials)
+        filename += "_Inline";
+    resultName = filename;
     
-    if(testStruct.doIterationTest) {
-        testStruct.iterations = iterations[num_of_test];
+    if(doingTest()) {
+        ff = fopen((filename + "_Frames.txt").c_str(),"w");
+        fprintf(ff, "Run\tRepeat\tFrame\tFrame Time\tSwap Time\tFirst Pass Time\tSecond Pass Time\tRay Statistics Time\tRefit Time\tRebuild Time\n");
+        
+        if(testStruct.bounceHistogram) {
+            bf = fopen((filename + "_Bounces.txt").c_str(),"w");
+            fprintf(bf, "Run\tSpheres\tIterations\tDistance\tRoulette\tBounces\tPixels\tFraction\tLow Throughput Bounces\n");
+        }
+        
+        if(testStruct.heatmap) {
+            hf = fopen((filename + "_Tiles.txt").c_str(),"w");
+            fprintf(hf, "Run\tSpheres\tIterations\tDistance\tX\tY\tWidth\tHeight\tRays\tSphere Tests\tMean Depth\tClock\tShare\n");
+        }
+        
+        if(testStruct.matrixFile) {
+            // One row per cell, comma separated with a header of # lines describing where it ran
+            char date[64];
+            time_t now = time(NULL);
+            strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&now));
+            df = fopen((filename + ".csv").c_str(),"w");
+            fprintf(df, "# matrix: %s, %d cells\n", testStruct.matrixFile, (int)cells.size());
+            fprintf(df, "# date: %s\n", date);
+            fprintf(df, "# gl_renderer: %s\n", renderer ? renderer : "none");
+            fprintf(df, "# gl_version: %s\n", driver ? driver : "none");
+            fprintf(df, "# cpu: %s, %u hardware threads\n", cpuName().c_str(), std::thread::hardware_concurrency());
+            fprintf(df, "# build: %s\n", buildFlags().c_str());
+            fprintf(df, "run,backend,accel,width,height,spheres,iterations,distance,plane,light_moving,refraction,specialized,layout,"
+                        "fps,fps_stddev,repeats,frame_ms_p50,frame_ms_p95,frame_ms_p99,first_pass_ms,second_pass_ms,ray_stats_ms,swap_ms,"
+                        "build_ms,first_pass_bytes,tile_list,primary_rays,reflection_rays,refraction_rays,shadow_rays,rays_per_second,threads\n");
+            return;
+        }
+        df = fopen((filename + ".txt").c_str(),"w");
+        if(testStruct.doReadbackTest)
+            fprintf(df, "Readback Buffers\tFrame Rate\tLatency Frames\tMax Latency Frames\tSpeedup\tRay Count");
+        else if(testStruct.doStandardTest)
+            fprintf(df, "Spheres\tIterations\tDistance\tPlane\tLight Moving\tRefraction\tFrame Rate\tRay Count%s",
+                    compareGeneric ? "\tGeneric Frame Rate\tSpecialization Speedup" : "");
+        else if(compareLinear)
+            fprintf(df, "Spheres\tIterations\tDistance\tFrame Rate\tRay Count\tLinear Frame Rate\tSpeedup\tBuild Time\tGrid Resolution");
+        else
+            fprintf(df, "Spheres\tIterations\tDistance\tFrame Rate\tRay Count");
+        fprintf(df, "\tPrimary Rays\tReflection Rays\tRefraction Rays\tShadow Rays\tShadow Rays Per Second");
+        fprintf(df, "\tP50 Frame Time\tP95 Frame Time\tP99 Frame Time\tFirst Pass Time\tSecond Pass Time\tRay Statistics Time\tSwap Time");
+        fprintf(df, "\tFrame Rate Stddev\tRepeats");
+        if(testStruct.screenBins)
+            fprintf(df, "\tMean Tile List\tBinning Time");
+        if(testStruct.backend == BACKEND_CPU)
+            fprintf(df, "\tRays Per Second\tRays Per Second Per Core\tThreads");
+        fprintf(df, "\n");
+    }
+}
+
+// Places the spheres and builds the acceleration structure for this run. Returns the structure trace() uses.
+int buildScene()
+{
+    int activeAccel = testStruct.accel;
+    if(sceneFile.Count > 0) {
+        // The GPU reads a scene file from the mapping, a CPU copy is only made for building a structure, screen bins or the CPU backend
+        spheres.clear();
+        if(activeAccel != ACCEL_LINEAR || testStruct.backend == BACKEND_CPU || testStruct.animation > 0.0f || testStruct.screenBins) {
+            spheres.resize(sceneFile.Count);
+            for(uint32_t i = 0; i < sceneFile.Count; i++) {
+                const float* record = sceneFile.Records + i * SCENE_FLOATS_PER_SPHERE;
+                spheres[i].position_r = glm::make_vec4(record);
+                spheres[i].material.color = glm::make_vec3(record + 4);
+                spheres[i].material.diff_spec_ref = glm::make_vec3(record + 8);
+            }
+        }
+    }
+    else {
+        // Positions for each spheres
+        int scale = int(cbrt(testStruct.nums));
+        spheres.resize(testStruct.nums);
+        for(int i = 0; i < testStruct.nums; i++) {
+            spheres[i].position_r = glm::vec4(-3.0f + 1.5f * (i % scale), 0.5f + 1.5f * (i / (scale * scale)), 0.0f - 1.5f * ((i % (scale * scale)) / scale), 0.5f);
+            spheres[i].material.color = glm::vec3(1.0f, 1.0f, 0.8f);
+            spheres[i].material.diff_spec_ref = glm::vec3(1.0f, 0.5f, 1.1f);
+        }
     }
     
-    // Standard Test:
+    buildTime = 0.0;
+    gridResolution = "-";
+    if(activeAccel == ACCEL_BVH) {
+        double buildStart = getTime();
+        bvh.Build(spheres);
+        buildTime = (getTime() - buildStart) * 1000.0;
+        builtCost = bvh.Cost();
+        std::cout << "BVH built in " << buildTime << " ms, " << bvh.Nodes.size() << " nodes, SAH cost " << builtCost << std::endl;
+    }
+    else if(activeAccel == ACCEL_GRID) {
+        double buildStart = getTime();
+        grid.Build(spheres);
+        buildTime = (getTime() - buildStart) * 1000.0;
+        gridResolution = std::to_string(grid.Resolution[0]) + "x" + std::to_string(grid.Resolution[1]) + "x" + std::to_string(grid.Resolution[2]);
+        std::cout << "Grid built in " << buildTime << " ms, " << gridResolution << " cells, " << grid.Indices.size() << " references" << std::endl;
+    }
+    
+    restPositions.resize(spheres.size());
+    for(size_t i = 0; i < spheres.size(); i++)
+        restPositions[i] = glm::vec3(spheres[i].position_r);
+    return activeAccel;
+}
+
+// Moves every sphere on its own loop around its rest position and updates the acceleration structure.
+// The BVH is refitted, and rebuilt when that has made its SAH cost rebuildRatio times the cost after the last build.
+// The grid is always rebuilt, its counting sort is linear. refitMs and rebuildMs are negative for what was not done.
+void animateScene(float time, int activeAccel, ThreadPool& pool, double& refitMs, double& rebuildMs)
+{
+    int count = (int)spheres.size();
+    const int chunk = 4096;
+    pool.Run((count + chunk - 1) / chunk, [&](int task, int /*worker*/) {
+        for(int i = task * chunk; i < std::min(count, (task + 1) * chunk); i++) {
+            float phase = 2.39996f * i; // Golden angle, neighbours move out of step
+            glm::vec3 offset(cos(time + phase), 0.5f + 0.5f * sin(2.0f * time + phase), sin(time + phase));
+            spheres[i].position_r = glm::vec4(restPositions[i] + testStruct.animation * offset, spheres[i].position_r.w);
+        }
+    });
+    
+    refitMs = rebuildMs = -1.0;
+    double start = getTime();
+    if(activeAccel == ACCEL_BVH) {
+        bvh.Refit(spheres, pool);
+        float cost = bvh.Cost();
+        refitMs = (getTime() - start) * 1000.0;
+        if(cost > builtCost * testStruct.rebuildRatio) {
+            start = getTime();
+            bvh.Build(spheres);
+            builtCost = bvh.Cost();
+            rebuildMs = (getTime() - start) * 1000.0;
+        }
+    }
+    else if(activeAccel == ACCEL_GRID) {
+        grid.Build(spheres);
+        rebuildMs = (getTime() - start) * 1000.0;
+    }
+}
+
+// Prints the mean scene update times of the measured frames
+void printUpdate(const FrameTimes& times)
+{
+    int rebuilds = 0, frames = 0;
+    double rebuildMs = times.MeanRebuild(&rebuilds);
+    for(size_t i = 0; i < times.Samples.size(); i++)
+        frames += times.Samples[i].repeat >= 0;
+    if(times.MeanRefit() >= 0.0)
+        std::cout << "  Refit " << times.MeanRefit() << " ms" << std::endl;
+    if(rebuilds > 0)
+        std::cout << "  Rebuild " << rebuildMs << " ms in " << rebuilds << " of " << frames << " frames" << std::endl;
+}
+
+// Prints the configuration of this run
+void printSettings(int activeAccel)
+{
+    std::cout << backendNames[testStruct.backend] << " backend at " << WIDTH * MUL << "x" << HEIGHT * MUL << std::endl;
+    std::cout << testStruct.nums << " Spheres" << std::endl;
+    if(testStruct.sceneFile)
+        std::cout << "Scene file " << testStruct.sceneFile << std::endl;
+    std::cout << testStruct.iterations << " Iterations" << std::endl;
+    std::cout << "Acceleration structure " << accelNames[activeAccel] << std::endl;
+    std::cout << "Camera Distance " << camera.Position.z << std::endl;
+    std::cout << "Has plane? " << (testStruct.withPlane ? "Yes" : "No") << std::endl;
+    std::cout << "Light moving? " << (testStruct.lightMoving ? "Yes" : "No") << std::endl;
+    std::cout << "Can refract? " << (testStruct.canRefract ? "Yes" : "No") << std::endl;
+    std::cout << "Ray calculation on? " << (testStruct.turnOffRayCalculation ? "No" : "Yes") << std::endl;
+    if(testStruct.backend == BACKEND_GL)
+        std::cout << "Path termination " << (testStruct.roulette ? "Russian roulette" : "fixed cutoff") << std::endl;
+    if(testStruct.backend == BACKEND_GL)
+        std::cout << "First pass " << (testStruct.specialize ? "specialized" : "generic") << ", "
+                  << (testStruct.inlineMaterials ? "materials inline in every sphere" : "material table") << std::endl;
+    if(testStruct.screenBins)
+        std::cout << "Primary rays binned into " << SCREEN_BIN_SIZE << "x" << SCREEN_BIN_SIZE << " screen tiles" << std::endl;
+    if(testStruct.backend != BACKEND_CPU)
+        std::cout << "Readback buffers " << testStruct.readbackSlots << (testStruct.readbackSlots == 0 ? " (synchronous)" : "") << std::endl;
+    if(testStruct.progressiveSamples > 0)
+        std::cout << "Progressive, up to " << testStruct.progressiveSamples << " samples per pixel" << std::endl;
+    if(testStruct.frameBudget > 0.0)
+        std::cout << "Tiled first pass, " << testStruct.frameBudget << " ms per present" << std::endl;
+    if(testStruct.animation > 0.0f)
+        std::cout << "Animated spheres, moving up to " << testStruct.animation << ", BVH rebuilt at " << testStruct.rebuildRatio << "x its SAH cost" << std::endl;
+    if(testStruct.pathFile)
+        std::cout << "Camera path " << testStruct.pathFile << " with " << cameraPath.Keyframes.size() << " keyframes over " << cameraPath.Duration() << " s" << std::endl;
+    else if(testStruct.measuredFrames > 0)
+        std::cout << testStruct.repeats << " x (" << testStruct.warmupFrames << " warmup + " << testStruct.measuredFrames << " measured frames)" << std::endl;
+    std::cout << std::endl;
+}
+
+// Prints a time in milliseconds, or "-" when it was not measured
+void printTime(FILE* f, double ms)
+{
+    if(ms < 0.0)
+        fprintf(f, "\t-");
+    else
+        fprintf(f, "\t%f", ms);
+}
+
+// Same for a CSV field, which is left empty when it was not measured
+void printField(FILE* f, double ms)
+{
+    if(ms < 0.0)
+        fprintf(f, ",");
+    else
+        fprintf(f, ",%f", ms);
+}
+
+// Writes every measured frame of this run to the frame file
+void writeFrames(const FrameTimes& times)
+{
+    for(size_t i = 0; i < times.Samples.size(); i++) {
+        const FrameSample& s = times.Samples[i];
+        if(s.repeat < 0)
+            continue;
+        fprintf(ff, "%d\t%d\t%d\t%f\t%f", runIndex, s.repeat, (int)i, s.frame, s.swap);
+        for(int p = 0; p < PASS_COUNT; p++)
+            printTime(ff, s.pass[p]);
+        printTime(ff, s.refit);
+        printTime(ff, s.rebuild);
+        fprintf(ff, "\n");
+    }
+    runIndex++;
+}
+
+// Prints the bounce histogram of the last frame and writes it to the bounce file if a test is running.
+// Must be called before writeResult(), which moves on to the next run index.
+void writeBounces(const BounceHistogram& histogram)
+{
+    long total = histogram.TotalPixels();
+    for(size_t d = 1; d < histogram.Pixels.size(); d++) {
+        if(bf)
+            fprintf(bf, "%d\t%d\t%d\t%f\t%d\t%d\t%ld\t%f\t%ld\n", runIndex, testStruct.nums, testStruct.iterations, camera.Position.z,
+                    testStruct.roulette, (int)d, histogram.Pixels[d], (double)histogram.Pixels[d] / total, histogram.LowBounces[d]);
+        else
+            std::cout << "  " << d << " bounces: " << 100.0 * histogram.Pixels[d] / total << "% of pixels" << std::endl;
+    }
+    std::cout << "Mean path length " << histogram.MeanDepth() << " bounces, " << 100.0 * histogram.LowFraction()
+              << "% of bounces traced with a throughput below 0.1" << std::endl;
+}
+
+// Writes the heatmap of every cost channel and the cost of every screen tile of the last frame, and prints the tiles that
+// took the largest share of it. Shares are of the shader clock where there is one and of the sphere tests otherwise.
+// Must be called before writeResult(), which moves on to the next run index.
+void writeHeatmaps(const CostProfile& profile)
+{
+    std::string prefix = doingTest() ? resultName + "_Heatmap_" + std::to_string(runIndex) : std::string("Heatmap");
+    for(int c = 0; c < COST_CHANNELS; c++) {
+        if(c == COST_CLOCK && !shaderClock)
+            continue;
+        std::string path = prefix + "_" + costNames[c] + ".png";
+        for(size_t i = 0; i < path.size(); i++)
+            if(path[i] == ' ')
+                path[i] = '_';
+        if(!profile.WriteHeatmap(c, path))
+            fprintf(stderr, "Cannot write %s\n", path.c_str());
+    }
+
+    int shareChannel = shaderClock ? COST_CLOCK : COST_SPHERE_TESTS;
+    double total = std::max(profile.Total(shareChannel), 1.0);
+    std::vector<CostProfile::Tile> tiles = profile.Tiles();
+    if(hf)
+        for(size_t i = 0; i < tiles.size(); i++) {
+            const CostProfile::Tile& t = tiles[i];
+            fprintf(hf, "%d\t%d\t%d\t%f\t%u\t%u\t%u\t%u\t%.0f\t%.0f\t%f\t", runIndex, testStruct.nums, testStruct.iterations, camera.Position.z,
+                    t.X, t.Y, t.Width, t.Height, t.Sum[COST_RAYS], t.Sum[COST_SPHERE_TESTS], t.Sum[COST_DEPTH] / (t.Width * t.Height));
+            if(shaderClock)
+                fprintf(hf, "%.0f", t.Sum[COST_CLOCK]);
+            else
+                fprintf(hf, "-");
+            fprintf(hf, "\t%f\n", t.Sum[shareChannel] / total);
+        }
+
+    std::sort(tiles.begin(), tiles.end(), [shareChannel](const CostProfile::Tile& a, const CostProfile::Tile& b) {
+        return a.Sum[shareChannel] > b.Sum[shareChannel];
+    });
+    std::cout << "Heatmaps written to " << prefix << "_*.png, " << profile.Total(COST_SPHERE_TESTS) / std::max(profile.Total(COST_RAYS), 1.0)
+              << " sphere tests per ray" << std::endl;
+    std::cout << "Costliest " << PROFILE_TILE_SIZE << " px tiles by " << costNames[shareChannel] << ":";
+    for(size_t i = 0; i < tiles.size() && i < 5; i++)
+        std::cout << " (" << tiles[i].X << ", " << tiles[i].Y << ") " << 100.0 * tiles[i].Sum[shareChannel] / total << "%";
+    std::cout << ", " << tiles.size() << " tiles" << std::endl;
+}
+
+// Writes the row of a matrix cell. GPU rows report the counted rays of one frame times the frame rate as rays per second.
+void writeCell(const BenchmarkClock& clock, const GLuint totals[4], const FrameTimes& times, double raysPerSecond, int threads)
+{
+    float fps = clock.MeanFps();
+    GLuint total = totals[PRIMARY_RAY] + totals[REFLECTION_RAY] + totals[REFRACTION_RAY] + totals[SHADOW_RAY];
+    if(threads == 0)
+        raysPerSecond = (double)total * fps;
+    fprintf(df, "%d,%s,%s,%u,%u,%d,%d,%f,%d,%d,%d,%d,%s", runIndex, backendNames[testStruct.backend], accelNames[testStruct.accel],
+            WIDTH * MUL, HEIGHT * MUL, testStruct.nums, testStruct.iterations, camera.Position.z, testStruct.withPlane, testStruct.lightMoving,
+            testStruct.canRefract, testStruct.backend == BACKEND_GL && testStruct.specialize,
+            testStruct.backend == BACKEND_CPU ? "" : layoutNames[testStruct.inlineMaterials]);
+    fprintf(df, ",%f,%f,%d,%f,%f,%f", fps, clock.StdDevFps(), clock.Repeat, times.Percentile(50), times.Percentile(95), times.Percentile(99));
+    for(int p = 0; p < PASS_COUNT; p++)
+        printField(df, times.MeanPass(p));
+    fprintf(df, ",%f,%f,", times.MeanSwap(), buildTime);
+    if(testStruct.backend == BACKEND_GL)
+        fprintf(df, "%d", firstPassBytes);
+    fprintf(df, ",");
+    if(testStruct.screenBins)
+        fprintf(df, "%f", binListLength);
+    fprintf(df, ",%u,%u,%u,%u,%f,", totals[PRIMARY_RAY], totals[REFLECTION_RAY], totals[REFRACTION_RAY], totals[SHADOW_RAY], raysPerSecond);
+    if(threads > 0)
+        fprintf(df, "%d", threads);
+    fprintf(df, "\n");
+    fflush(df); // A long matrix keeps the finished cells if it is stopped
+}
+
+// Writes one row of the result file and the frames of this run. The frame rate is the mean over the repeats.
+// readback is only used by the readback test, threads > 0 adds the CPU backend columns.
+void writeResult(const BenchmarkClock& clock, const GLuint totals[4], const ReadbackRing* readback, const FrameTimes& times, double raysPerSecond, int threads)
+{
+    if(testStruct.matrixFile)
+        writeCell(clock, totals, times, raysPerSecond, threads); // Before writeFrames() moves on to the next run index
+    writeFrames(times);
+    float fps = clock.MeanFps();
+    if(clock.Repeat > 1)
+        std::cout << "Frame rate " << fps << " +- " << clock.StdDevFps() << " over " << clock.Repeat << " repeats ("
+                  << 100.0 * clock.StdDevFps() / fps << "%)" << std::endl;
+    std::cout << "Frame time p50 " << times.Percentile(50) << " ms, p95 " << times.Percentile(95) << " ms, p99 " << times.Percentile(99) << " ms" << std::endl;
+    
+    // Shadow rays only answer occluded(), so their rate is reported apart from the closest-hit rays
+    double shadowRate = (double)totals[SHADOW_RAY] * fps;
+    std::cout << shadowRate << " shadow rays per second" << std::endl;
+    if(testStruct.screenBins)
+        std::cout << "Primary rays tested " << binListLength << " of " << testStruct.nums << " spheres per " << SCREEN_BIN_SIZE << "x" << SCREEN_BIN_SIZE
+                  << " tile on average, binned in " << binTime << " ms" << std::endl;
+
+    GLuint total = totals[PRIMARY_RAY] + totals[REFLECTION_RAY] + totals[REFRACTION_RAY] + totals[SHADOW_RAY];
+    if(measuringBaseline)
+        baselineFps = fps; // Row is written after the same configuration ran with the acceleration structure or specialized variant
+    else if(!testStruct.matrixFile) {
+        if(testStruct.doReadbackTest) {
+            if(testStruct.readbackSlots == 0)
+                syncFps = fps;
+            fprintf(df, "%d\t%f\t%ld\t%ld\t%f\t%u", testStruct.readbackSlots, fps, readback->Latency, readback->MaxLatency, fps / syncFps, total);
+            std::cout << testStruct.readbackSlots << " readback buffers: " << readback->MaxLatency << " frames of latency, "
+                      << fps / syncFps << "x the synchronous frame rate" << std::endl;
+        }
+        else if(testStruct.doStandardTest) {
+            fprintf(df, "%d\t%d\t%f\t%d\t%d\t%d\t%f\t%u", testStruct.nums, testStruct.iterations, camera.Position.z, testStruct.withPlane, testStruct.lightMoving, testStruct.canRefract, fps, total);
+            if(compareGeneric) {
+                fprintf(df, "\t%f\t%f", baselineFps, fps / baselineFps);
+                std::cout << "Speedup of the specialized first pass: " << fps / baselineFps << std::endl;
+            }
+        }
+        else if(compareLinear) {
+            fprintf(df, "%d\t%d\t%f\t%f\t%u\t%f\t%f\t%f\t%s", testStruct.nums, testStruct.iterations, camera.Position.z, fps, total, baselineFps, fps / baselineFps, buildTime, gridResolution.c_str());
+            std::cout << "Speedup over linear at " << testStruct.nums << " spheres: " << fps / baselineFps << std::endl;
+            if(crossover < 0 && fps > baselineFps)
+                crossover = testStruct.nums;
+        }
+        else
+            fprintf(df, "%d\t%d\t%f\t%f\t%u", testStruct.nums, testStruct.iterations, camera.Position.z, fps, total);
+        fprintf(df, "\t%u\t%u\t%u\t%u\t%f", totals[PRIMARY_RAY], totals[REFLECTION_RAY], totals[REFRACTION_RAY], totals[SHADOW_RAY], shadowRate);
+        fprintf(df, "\t%f\t%f\t%f", times.Percentile(50), times.Percentile(95), times.Percentile(99));
+        for(int p = 0; p < PASS_COUNT; p++)
+            printTime(df, times.MeanPass(p));
+        fprintf(df, "\t%f", times.MeanSwap());
+        fprintf(df, "\t%f\t%d", clock.StdDevFps(), clock.Repeat);
+        if(testStruct.screenBins)
+            fprintf(df, "\t%f\t%f", binListLength, binTime);
+        if(threads > 0)
+            fprintf(df, "\t%f\t%f\t%d", raysPerSecond, raysPerSecond / threads, threads);
+        fprintf(df, "\n");
+    }
+}
+
+// Prints the crossover of a number test with an acceleration structure and closes the result files
+void finishTests()
+{
+    if(compareLinear) {
+        if(crossover > 0)
+            std::cout << accelNames[testStruct.accel] << " overtakes the linear loop at " << crossover << " spheres" << std::endl;
+        else
+            std::cout << accelNames[testStruct.accel] << " never overtook the linear loop" << std::endl;
+    }
+    
+    // Close files
+    if(df)
+        fclose(df);
+    if(ff)
+        fclose(ff);
+    if(bf)
+        fclose(bf);
+    if(hf)
+        fclose(hf);
+}
+
+// #define block of the first pass for this run. The generic shader reads the flags from uniforms and only gets PROFILE,
+// INLINE_MATERIALS and SCREEN_BINS, which change what it writes and reads instead of constants.
+// Variants are keyed by plane, refraction, iterations and, for the linear loop, the sphere count rounded up to a power of two.
+std::string firstPassDefines(int activeAccel)
+{
+    std::string defines = testStruct.heatmap ? "#define PROFILE\n" : "";
+    if(testStruct.inlineMaterials)
+        defines += "#define INLINE_MATERIALS\n";
+    if(testStruct.screenBins)
+        defines += "#define SCREEN_BINS " + std::to_string(SCREEN_BIN_SIZE) + "\n";
+    if(!testStruct.specialize)
+        return defines;
+    defines += std::string("#define WITH_PLANE ") + (testStruct.withPlane ? "true" : "false") + "\n";
+    defines += std::string("#define CAN_REFRACT ") + (testStruct.canRefract ? "true" : "false") + "\n";
+    defines += "#define ITERATIONS " + std::to_string(testStruct.iterations) + "\n";
+    defines += std::string("#define ROULETTE ") + (testStruct.roulette ? "true" : "false") + "\n";
+    if(activeAccel == ACCEL_LINEAR) {
+        int bucket = 1;
+        while(bucket < testStruct.nums)
+            bucket *= 2;
+        defines += "#define SPHERE_BUCKET " + std::to_string(bucket) + "\n";
+    }
+    return defines;
+}
+
+// Element index of the Halton sequence with the given base, in [0, 1)
+float halton(int index, int base)
+{
+    float result = 0.0f, f = 1.0f;
+    while(index > 0) {
+        f /= base;
+        result += f * (index % base);
+        index /= base;
+    }
+    return result;
+}
+
+// Renders the configuration of the current cell on the CPU backend, until it is measured or forever without a test
+void runCPUCell(ThreadPool& pool, CPURenderer& renderer)
+{
+    FrameTimes times;
+    BenchmarkClock clock(testStruct.warmupFrames, testStruct.measuredFrames, testStruct.repeats);
+    int activeAccel = buildScene();
+    printSettings(activeAccel);
+    
+    double frameEnd = getTime();
+    double rays = 0.0, raysTime = 0.0; // Over every measurement of this configuration
+    clock.Start(frameEnd);
+    while (true) {
+        GLfloat current = clock.Time(getTime());
+        bool measured = !clock.Warming();
+        double refitMs = -1.0, rebuildMs = -1.0;
+        if(testStruct.animation > 0.0f)
+            animateScene(current, activeAccel, pool, refitMs, rebuildMs);
+        
+        // Same uniforms as the first pass, the camera does not rotate without a window
+        RenderSettings settings;
+        settings.width = WIDTH * MUL;
+        settings.height = HEIGHT * MUL;
+        settings.viewPos = camera.Position;
+        settings.lightDirection = glm::vec3(-1.0f + 4.0f * cos(current) * testStruct.lightMoving, 1.5f, 1.0f + 4.0f * sin(current) * testStruct.lightMoving);
+        settings.rot = glm::mat3();
+        settings.iterations = testStruct.iterations;
+        settings.withPlane = testStruct.withPlane;
+        settings.canRefract = testStruct.canRefract;
+        settings.accel = activeAccel;
+        renderer.Render(settings, pool);
+        if(measured)
+            rays += renderer.Total();
+        
+        // Calculate frame rates
+        double currentTime = getTime();
+        times.Add((currentTime - frameEnd) * 1000.0, 0.0, measured ? clock.Repeat : -1);
+        times.SetUpdate(refitMs, rebuildMs);
+        frameEnd = currentTime;
+        if (clock.EndFrame(currentTime)) {
+            raysTime += clock.Elapsed;
+            double raysPerSecond = rays / raysTime;
+            std::cout << clock.Fps << " frames per second, " << raysPerSecond << " rays per second, "
+                      << raysPerSecond / pool.Size() << " per core" << std::endl;
+            if(!clock.Done())
+                continue;
+            if(testStruct.animation > 0.0f)
+                printUpdate(times);
+            
+            if(doingTest()) {
+                // Like the GL backend, rows without ray calculation report no rays
+                GLuint none[4] = {0, 0, 0, 0};
+                writeResult(clock, testStruct.turnOffRayCalculation ? none : renderer.Totals, NULL, times, raysPerSecond, pool.Size());
+                break;
+            }
+            times.Clear();
+            rays = raysTime = 0.0;
+            clock.Start(currentTime);
+        }
+    }
+}
+
+// Runs a sweep that only uses the CPU backend, or a free-running benchmark on it. No OpenGL context is created.
+void runCPU()
+{
+    ThreadPool pool(testStruct.threads);
+    CPURenderer renderer;
+    renderer.SetScene(&spheres, &bvh, &grid);
+    std::cout << "Tested on the CPU backend using " << pool.Size() << " threads" << std::endl;
+    
+    openResultFile(NULL, NULL);
+    for(size_t i = 0; i < cells.size(); i++) {
+        applyCell(cells[i]);
+        runCPUCell(pool, renderer);
+    }
+    finishTests();
+}
+
+// Worker of distributed rendering: connects to the coordinator and renders with the arguments it sends
+void joinCoordinator()
+{
+    signal(SIGPIPE, SIG_IGN);   // A lost coordinator shows up as a failed send instead
+    uint32_t count = 0;
+    if(!coordinator.Connect(testStruct.workerAddress) || !coordinator.Receive(&count, sizeof(count))) {
+        fprintf(stderr, "No coordinator at %s\n", testStruct.workerAddress);
+        exit(EXIT_FAILURE);
+    }
+    coordinatorArguments.resize(count);
+    for(uint32_t i = 0; i < count; i++)
+        if(!coordinator.ReceiveString(coordinatorArguments[i])) {
+            fprintf(stderr, "Lost the coordinator during the handshake\n");
+            exit(EXIT_FAILURE);
+        }
+    std::vector<char*> arguments(1, (char*)"worker");
+    for(uint32_t i = 0; i < count; i++)
+        arguments.push_back(&coordinatorArguments[i][0]);
+    parseArgs((int)arguments.size(), &arguments[0], &testStruct);
+}
+
+// Coordinator of distributed rendering. Spawns the local workers, waits for the remote ones, then renders the frame
+// in tiles on the first 1 to N workers and writes the frame rate and scaling efficiency of every worker count to
+// DistributedTest.txt. The frame is measured like any other run: -frames, -warmup and -repeat, or a 5 second window.
+// Workers render with the arguments of this process, minus the distribution flags and plus --headless, so a scene file
+// must exist under the same path on remote machines. Each worker count also writes its last frame as a PNG file, and
+// with -frames every one must match the frame of a single worker.
+void runDistributed(int argc, char **argv)
+{
+    signal(SIGPIPE, SIG_IGN);   // A worker that died shows up as a failed send instead
+    Listener listener;
+    if(!listener.Listen(testStruct.distributePort, testStruct.remoteWorkers > 0))
+        exit(EXIT_FAILURE);
+    std::vector<std::string> arguments;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-distribute") == 0 || strcmp(argv[i], "-remote") == 0 || strcmp(argv[i], "-port") == 0)
+            i++;
+        else
+            arguments.push_back(argv[i]);
+    }
+    arguments.push_back("--headless");
+    
+    // Local workers run this program again, their settings would only repeat ours
+    std::string address = "127.0.0.1:" + std::to_string(listener.Port);
+    std::vector<pid_t> children;
+    for(int i = 0; i < testStruct.localWorkers; i++) {
+        pid_t pid = fork();
+        if(pid == 0) {
+            listener.Close();
+            if(!freopen("/dev/null", "w", stdout))
+                fprintf(stderr, "Worker output is not discarded\n");
+            execlp(argv[0], argv[0], "-worker", address.c_str(), (char*)NULL);
+            fprintf(stderr, "Cannot start worker %s\n", argv[0]);
+            _exit(127);
+        }
+        children.push_back(pid);
+    }
+    if(testStruct.remoteWorkers > 0)
+        std::cout << "Waiting for " << testStruct.remoteWorkers << " remote workers, start them with " << argv[0]
+                  << " -worker <this host>:" << listener.Port << std::endl;
+    
+    int total = testStruct.localWorkers + testStruct.remoteWorkers;
+    std::vector<Connection> workers(total);
+    for(int connected = 0; connected < total; ) {
+        if(listener.Accept(workers[connected], 1000)) {
+            connected++;
+            continue;
+        }
+        for(size_t c = 0; c < children.size(); c++)
+            if(waitpid(children[c], NULL, WNOHANG) == children[c]) {
+                fprintf(stderr, "A local worker exited before connecting\n");
+                exit(EXIT_FAILURE);
+            }
+    }
+    listener.Close();
+    
+    // Every worker compiles its first pass before it reports, so the measurement starts with all of them ready
+    double startupStart = getTime();
+    for(int w = 0; w < total; w++) {
+        uint32_t count = (uint32_t)arguments.size();
+        bool sent = workers[w].Send(&count, sizeof(count));
+        for(size_t i = 0; i < arguments.size(); i++)
+            sent = sent && workers[w].SendString(arguments[i]);
+        if(!sent) {
+            fprintf(stderr, "Lost worker %d during the handshake\n", w);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for(int w = 0; w < total; w++) {
+        std::string renderer;
+        if(!workers[w].ReceiveString(renderer)) {
+            fprintf(stderr, "Worker %d exited before it was ready\n", w);
+            exit(EXIT_FAILURE);
+        }
+        std::cout << "Worker " << w << " ready on " << renderer << std::endl;
+    }
+    std::cout << total << " workers ready in " << (getTime() - startupStart) * 1000.0 << " ms" << std::endl;
+    printSettings(testStruct.accel);
+    
+    GLuint width = WIDTH * MUL, height = HEIGHT * MUL;
+    std::vector<unsigned char> frame((size_t)width * height * 4), reference;
+    TileQueue queue(width, height);
+    std::cout << queue.Tiles.size() << " tiles of " << DISTRIBUTED_TILE_SIZE << "x" << DISTRIBUTED_TILE_SIZE << " pixels per frame" << std::endl;
+    
+    // Statistics of the measured frames of one worker count
+    std::vector<double> busy;  // Milliseconds of tiles per worker
+    GLuint totals[4];          // Rays of the last frame
+    long batches = 0;
+    double bytes = 0.0;
+    
+    // Renders one frame on the first k workers into frame. Every worker has up to BATCHES_IN_FLIGHT batches queued,
+    // and gets the next one from the queue as soon as one of its results is in.
+    auto renderFrame = [&](int k, BatchHeader header, bool measured) {
+        queue.Start();
+        std::vector<int> inFlight(k, 0);
+        size_t received = 0;
+        for(int i = 0; i < 4; i++)
+            totals[i] = 0;
+        while(received < queue.Tiles.size()) {
+            for(int level = 0; level < BATCHES_IN_FLIGHT; level++)
+                for(int w = 0; w < k && !queue.Empty(); w++) {
+                    if(inFlight[w] > level)
+                        continue;
+                    std::vector<TileJob> batch = queue.Next(k);
+                    header.tiles = (uint32_t)batch.size();
+                    if(!workers[w].Send(&header, sizeof(header)) || !workers[w].Send(&batch[0], sizeof(TileJob) * batch.size()))
+                        return false;
+                    inFlight[w]++;
+                    if(measured)
+                        batches++;
+                }
+            
+            std::vector<struct pollfd> fds;
+            std::vector<int> owners;
+            for(int w = 0; w < k; w++)
+                if(inFlight[w] > 0) {
+                    struct pollfd p = {workers[w].Fd, POLLIN, 0};
+                    fds.push_back(p);
+                    owners.push_back(w);
+                }
+            if(poll(&fds[0], fds.size(), -1) < 0)
+                return false;
+            for(size_t i = 0; i < fds.size(); i++) {
+                if(!fds[i].revents)
+                    continue;
+                int w = owners[i];
+                uint32_t count = 0;
+                if(!workers[w].Receive(&count, sizeof(count)))
+                    return false;
+                for(uint32_t t = 0; t < count; t++) {
+                    TileResult result;
+                    if(!workers[w].Receive(&result, sizeof(result)) || result.index >= queue.Tiles.size())
+                        return false;
+                    const TileQueue::Tile& tile = queue.Tiles[result.index];
+                    for(GLuint row = 0; row < tile.Height; row++)
+                        if(!workers[w].Receive(&frame[((size_t)(tile.Y + row) * width + tile.X) * 4], tile.Width * 4))
+                            return false;
+                    queue.Measured(result.index, result.ms);
+                    for(int r = 0; r < 4; r++)
+                        totals[r] += result.rays[r];
+                    if(measured) {
+                        busy[w] += result.ms;
+                        bytes += sizeof(result) + tile.Width * tile.Height * 4.0;
+                    }
+                    received++;
+                }
+                inFlight[w]--;
+            }
+        }
+        return true;
+    };
+    
+    FILE* f = fopen("DistributedTest.txt", "w");
+    fprintf(f, "Workers\tFrame Rate\tFrame Rate Stddev\tSpeedup\tEfficiency\tLoad Balance\tBatches Per Frame\tTransfer Per Frame\tRay Count\tMax Pixel Difference\n");
+    BenchmarkClock clock(testStruct.warmupFrames, testStruct.measuredFrames, testStruct.repeats);
+    double singleFps = 0.0;
+    for(int k = 1; k <= total; k++) {
+        busy.assign(k, 0.0);
+        batches = 0;
+        bytes = 0.0;
+        long measuredFrames = 0;
+        uint32_t frameIndex = 0;
+        clock.Start(getTime());
+        while(true) {
+            float current = clock.Time(getTime());
+            bool measured = !clock.Warming();
+            BatchHeader header;
+            header.frame = frameIndex;
+            header.seed = frameIndex++;
+            glm::vec3 lightDirection(-1.0f + 4.0f * cos(current) * testStruct.lightMoving, 1.5f, 1.0f + 4.0f * sin(current) * testStruct.lightMoving);
+            glm::mat3 rot;  // The camera does not rotate without a window
+            memcpy(header.viewPos, glm::value_ptr(camera.Position), sizeof(header.viewPos));
+            memcpy(header.rot, glm::value_ptr(rot), sizeof(header.rot));
+            memcpy(header.light, glm::value_ptr(lightDirection), sizeof(header.light));
+            if(!renderFrame(k, header, measured)) {
+                fprintf(stderr, "Lost a worker while rendering on %d of them\n", k);
+                exit(EXIT_FAILURE);
+            }
+            if(measured)
+                measuredFrames++;
+            if(clock.EndFrame(getTime())) {
+                if(clock.Fixed())
+                    std::cout << "Repeat " << clock.Repeat << ": " << clock.Fps << " frames per second on " << k << " workers" << std::endl;
+                if(clock.Done())
+                    break;
+            }
+        }
+        
+        // Load balance is the mean time a worker spent on tiles over the longest one, 1 when all were equally busy
+        double fps = clock.MeanFps(), maxBusy = *std::max_element(busy.begin(), busy.end()), meanBusy = 0.0;
+        for(int w = 0; w < k; w++)
+            meanBusy += busy[w] / k;
+        if(k == 1)
+            singleFps = fps;
+        double speedup = singleFps > 0.0 ? fps / singleFps : 0.0;
+        double balance = maxBusy > 0.0 ? meanBusy / maxBusy : 1.0;
+        int difference = -1;
+        if(clock.Fixed() && k == 1)
+            reference = frame;
+        else if(clock.Fixed()) {
+            difference = 0;
+            for(size_t i = 0; i < frame.size(); i++)
+                difference = std::max(difference, std::abs(int(frame[i]) - int(reference[i])));
+        }
+        std::string image = "DistributedTest_" + std::to_string(k) + ".png";
+        if(!writePNG(image.c_str(), &frame[0], width, height))
+            fprintf(stderr, "Cannot write %s\n", image.c_str());
+        
+        std::cout << k << " workers: " << fps << " frames per second, speedup " << speedup << ", efficiency " << speedup / k
+                  << ", load balance " << balance << ", " << double(batches) / measuredFrames << " batches and "
+                  << bytes / measuredFrames / 1e6 << " MB per frame";
+        if(difference > 0)
+            std::cout << ", differs from 1 worker by up to " << difference;
+        std::cout << std::endl;
+        fprintf(f, "%d\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%u\t", k, fps, clock.StdDevFps(), speedup, speedup / k, balance,
+                double(batches) / measuredFrames, bytes / measuredFrames / 1e6, totals[0] + totals[1] + totals[2] + totals[3]);
+        if(difference >= 0)
+            fprintf(f, "%d\n", difference);
+        else
+            fprintf(f, "-\n");
+    }
+    fclose(f);
+    
+    // An empty batch ends a worker
+    BatchHeader quit;
+    memset(&quit, 0, sizeof(quit));
+    for(int w = 0; w < total; w++) {
+        workers[w].Send(&quit, sizeof(quit));
+        workers[w].Close();
+    }
+    for(size_t c = 0; c < children.size(); c++)
+        waitpid(children[c], NULL, 0);
+}
+
+int main(int argc, char **argv)
+{
+    // Startup time is reported once the first frame can be rendered
+    double startupStart = getTime();
+    bool started = false;
+    
+    // Initialize parameters and parse arguments
+    testStruct.nums = INIT_SPHERE_NUM;
+    testStruct.iterations = INIT_ITERATION_NUM;
+    testStruct.accel = ACCEL_LINEAR;
+    testStruct.readbackSlots = INIT_READBACK_SLOTS;
+    testStruct.backend = BACKEND_GL;
+    testStruct.threads = 0;
+    testStruct.warmupFrames = INIT_WARMUP_FRAMES;
+    testStruct.measuredFrames = 0;
+    testStruct.repeats = INIT_REPEATS;
+    testStruct.progressiveSamples = 0;
+    testStruct.frameBudget = 0.0;
+    testStruct.sceneFile = NULL;
+    testStruct.animation = 0.0f;
+    testStruct.rebuildRatio = INIT_REBUILD_RATIO;
+    testStruct.matrixFile = NULL;
+    testStruct.pathFile = NULL;
+    testStruct.outputDir = "frames";
+    testStruct.writerThreads = 0;
+    testStruct.localWorkers = 0;
+    testStruct.remoteWorkers = 0;
+    testStruct.distributePort = 0;
+    testStruct.workerAddress = NULL;
+    testStruct.withPlane = true;
+    testStruct.lightMoving = true;
+    testStruct.canRefract = true;
+    testStruct.turnOffRayCalculation = false;
+    testStruct.headless = false;
+    testStruct.specialize = true;
+    testStruct.roulette = false;
+    testStruct.bounceHistogram = false;
+    testStruct.heatmap = false;
+    testStruct.inlineMaterials = false;
+    testStruct.screenBins = false;
+    testStruct.doNumberTest = false;
+    testStruct.doDistanceTest = false;
+    testStruct.doIterationTest = false;
+    testStruct.doStandardTest = false;
+    testStruct.doReadbackTest = false;
+    
+    parseArgs(argc, argv, &testStruct);
+    if(testStruct.workerAddress)
+        joinCoordinator();
+    initTests();
+    
+    // The coordinator of distributed rendering only hands out tiles, the workers have the contexts
+    if(testStruct.localWorkers > 0 || testStruct.remoteWorkers > 0) {
+        runDistributed(argc, argv);
+        return 0;
+    }
+    
+    // The CPU backend needs no OpenGL context at all
+    if(!sweepUses(BACKEND_GL) && !sweepUses(BACKEND_WAVEFRONT)) {
+        runCPU();
+        return 0;
+    }
+    
+    // Compute shaders of the wavefront backend need OpenGL 4.3, Mac OS stops at 4.1
+    int minorVersion = sweepUses(BACKEND_WAVEFRONT) ? 3 : 1;
+    GLFWwindow* window = nullptr;
+    HeadlessContext headless;
+#ifdef __linux__
+    if(testStruct.headless) {
+        // Surfaceless EGL context, no window system needed
+        if(!headless.Create(4, minorVersion)) {
+            fprintf(stderr, "Failed to create headless context.\n");
+            exit(EXIT_FAILURE);
+        }
+    } else
+#endif
+    {
+        // Init GLFW
+        glfwInit();
+        // Set all the required options for GLFW
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, minorVersion);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+        // Without EGL (Mac OS) headless mode falls back to a hidden window
+        glfwWindowHint(GLFW_VISIBLE, testStruct.headless ? GL_FALSE : GL_TRUE);
+        
+        // Create a GLFWwindow object that we can use for GLFW's functions
+        window = glfwCreateWindow(WIDTH, HEIGHT, "Ray Tracing", nullptr, nullptr);
+        if(!window) {
+            fprintf(stderr, "Failed to create GLFW window.\n");
+            glfwTerminate();
+            exit(EXIT_FAILURE);
+        }
+        glfwMakeContextCurrent(window);
+        
+        // Benchmarks must not be capped by vsync
+        if(doingTest())
+            glfwSwapInterval(0);
+        
+        if(!testStruct.headless) {
+            // Set the required callback functions
+            glfwSetKeyCallback(window, key_callback);
+            glfwSetCursorPosCallback(window, mouse_callback);
+            glfwSetScrollCallback(window, scroll_callback);
+            
+            // GLFW Options
+            glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        }
+    }
+    
+    // Set this to true so GLEW knows to use a modern approach to retrieving function pointers and extensions
+    glewExperimental = GL_TRUE;
+    // Initialize GLEW to setup the OpenGL Function pointers
+    // With an EGL context GLEW may report a missing GLX display, but the GL entry points are still loaded
+    glewInit();
+    
+    for(size_t i = 0; i < cells.size(); i++)
+        if(cells[i].test.backend != BACKEND_CPU && cells[i].test.nums > SphereBuffer::MaxSpheres(cells[i].test.inlineMaterials)) { // Check if sphere number exceeds texture buffer limit
+            fprintf(stderr, "Too many spheres! This GPU supports at most %d.\n", SphereBuffer::MaxSpheres(cells[i].test.inlineMaterials));
+            exit(EXIT_FAILURE);
+        }
+    
+    // Standard Test:
     // 125 Spheres
     // 6 Iterations
     // Camera distance 10
@@ -284,9 +1828,6 @@ int main(int argc, char **argv)
     // Calculate ray count
     // Resolution 800*600
     
-    // Array to store ray calculation count data
-    GLfloat* rayRateArray = new GLfloat[WIDTH * MUL * HEIGHT * MUL];
-    
     // Two arrays both containing two triangles to cover the whole window for the first pass and second pass, respectively
     GLfloat first_pass_quad[] = {
         -1.0f, -1.0f,
@@ -345,25 +1886,65 @@ int main(int argc, char **argv)
     glGenTextures(1, &image);
     glGenTextures(1, &data);
     
-    // Image texture
+    // Image texture, RGBA8 so the wavefront backend can also write it with imageStore()
     glBindTexture(GL_TEXTURE_2D, image);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WIDTH * MUL, HEIGHT * MUL, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, WIDTH * MUL, HEIGHT * MUL, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glBindTexture(GL_TEXTURE_2D, 0);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, image, 0);
     
-    // Data texture
+    // Data texture, exact ray counts per pixel with one channel per ray type
     glBindTexture(GL_TEXTURE_2D, data);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WIDTH * MUL, HEIGHT * MUL, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, WIDTH * MUL, HEIGHT * MUL, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glBindTexture(GL_TEXTURE_2D, 0);
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, data, 0);
     
-    // Render to multiple textures
-    GLenum DrawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
-    glDrawBuffers(2, DrawBuffers);
+    // Clear color of the image texture. Draw buffer 0 is the only float one, so it is cleared with glClearBufferfv()
+    const GLfloat background[4] = {0.3f, 0.3f, 0.3f, 1.0f};
+    
+    // Accumulation texture, sum of the progressive samples with the sample count in alpha
+    bool progressive = testStruct.progressiveSamples > 0;
+    GLuint accumulation;
+    glGenTextures(1, &accumulation);
+    glBindTexture(GL_TEXTURE_2D, accumulation);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, WIDTH * MUL, HEIGHT * MUL, 0, GL_RGBA, GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, accumulation, 0);
+    
+    // Bounce texture, path length and low throughput bounces of every pixel
+    GLuint bounceTexture;
+    glGenTextures(1, &bounceTexture);
+    glBindTexture(GL_TEXTURE_2D, bounceTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8UI, WIDTH * MUL, HEIGHT * MUL, 0, GL_RG_INTEGER, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, bounceTexture, 0);
+    
+    // Cost texture, rays, sphere tests, bounces and shader clock cycles of every pixel
+    GLuint costTexture;
+    glGenTextures(1, &costTexture);
+    glBindTexture(GL_TEXTURE_2D, costTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, WIDTH * MUL, HEIGHT * MUL, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT4, GL_TEXTURE_2D, costTexture, 0);
+    
+    // Render to multiple textures, the accumulation texture only in progressive mode where it is summed by additive blending,
+    // the bounce texture only when its histogram is recorded and the cost texture only with heatmaps
+    GLenum DrawBuffers[5] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, (GLenum)(progressive ? GL_COLOR_ATTACHMENT2 : GL_NONE),
+                             (GLenum)(testStruct.bounceHistogram ? GL_COLOR_ATTACHMENT3 : GL_NONE), GL_COLOR_ATTACHMENT4};
+    glDrawBuffers(testStruct.heatmap ? 5 : testStruct.bounceHistogram ? 4 : progressive ? 3 : 2, DrawBuffers);
+    if(progressive) {
+        glEnablei(GL_BLEND, 2);
+        glBlendFunci(2, GL_ONE, GL_ONE);
+    }
     
     // Check FBO validity
     if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
@@ -380,231 +1961,696 @@ int main(int argc, char **argv)
     
     // Build and compile our shader programs
     // On Mac OS with Xcode we use absolute path, while on other IDE relative path is allowed
-    Shader firstPassShader("first_pass.vs",
-                           "first_pass.frag");
+    ShaderVariants firstPassVariants("first_pass.vs",
+                                     "first_pass.frag");
+    Shader* firstPassShader = NULL;    // Variant of the current run
     Shader secondPassShader("second_pass.vs",
                             "second_pass.frag");
+    secondPassShader.Use();
+    glUniform1i(glGetUniformLocation(secondPassShader.Program, "texture1"), 0);
+    glUniform1i(glGetUniformLocation(secondPassShader.Program, "accumulation"), 1);
+    glUniform1i(glGetUniformLocation(secondPassShader.Program, "progressive"), progressive);
+    
+    // Progressive mode: samples in the accumulation texture and the view they were traced with
+    int accumulated = 0;
+    double progressiveStart = 0.0;
+    glm::vec3 lastViewPos, lastLight;
+    glm::mat3 lastRot;
+    
+    // Replaces the first pass with compute dispatches in the cells of the wavefront backend
+    WavefrontRenderer* wavefrontRenderer = NULL;
+    if(sweepUses(BACKEND_WAVEFRONT))
+        wavefrontRenderer = new WavefrontRenderer(WIDTH * MUL, HEIGHT * MUL);
+    
+    // Path length of every pixel, counted at the end of each measurement
+    BounceHistogram bounces;
+    CostProfile profile;
+    GLuint frameSeed = 0;   // Seed of the roulette decisions, one per frame
+    
+    // Moves the spheres and refits the BVH of an animated scene, and renders the cells of the CPU backend in a mixed sweep
+    ThreadPool* pool = NULL;
+    CPURenderer* cpuRenderer = NULL;
+    if(testStruct.animation > 0.0f || sweepUses(BACKEND_CPU))
+        pool = new ThreadPool(testStruct.threads);
+    if(sweepUses(BACKEND_CPU)) {
+        cpuRenderer = new CPURenderer();
+        cpuRenderer->SetScene(&spheres, &bvh, &grid);
+        std::cout << "CPU backend cells use " << pool->Size() << " threads" << std::endl;
+    }
+    double refitMs = -1.0, rebuildMs = -1.0;    // Scene update of the frame being drawn
+    
+    // Draws the first pass in tiles, as many per present as fit into the budget
+    TileScheduler* tiles = NULL;
+    if(testStruct.frameBudget > 0.0)
+        tiles = new TileScheduler(WIDTH * MUL, HEIGHT * MUL, testStruct.frameBudget);
+    
+    // Sums the data texture on the GPU and reads the totals back through a ring of pixel pack buffers
+    RayStats rayStats(WIDTH * MUL, HEIGHT * MUL, testStruct.readbackSlots);
+    
+    // GPU time of every pass, read back a few frames late
+    GPUTimer gpuTimer;
+    FrameTimes times;
+    BenchmarkClock clock(testStruct.warmupFrames, testStruct.measuredFrames, testStruct.repeats);
+    
+    // Sphere data lives in a texture buffer bound to texture unit 1 of the first pass,
+    // BVH nodes on 2, sphere indices of the BVH or grid on 3 and grid cells on 4
+    SphereBuffer sphereBuffer;
+    ScreenBins screenBins;
+    TextureBuffer bvhNodes(GL_RGBA32I), sphereIndices(GL_R32I), gridCells(GL_R32I);
     
     
     std::cout << "Tested on " << glGetString(GL_RENDERER) << 
                 " using " << glGetString(GL_VERSION) << std::endl;
     
-    double lastTime = glfwGetTime();
-    int nbFrames = 0;
+    if(testStruct.heatmap) {
+        GLint extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+        for(GLint i = 0; i < extensions; i++)
+            if(strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_shader_clock") == 0)
+                shaderClock = true;
+        std::cout << "Heatmaps " << (shaderClock ? "with" : "without") << " shader clock" << std::endl;
+    }
     
-    std::string filename = "";
-    if(testStruct.doNumberTest)
-        filename += "NumberTest";
-    else if(testStruct.doIterationTest)
-        filename += "IterationTest";
-    else if(testStruct.doDistanceTest)
-        filename += "DistanceTest";
-    else if(testStruct.doStandardTest)
-        filename += "Standard";
-
-    if(!testStruct.doNumberTest && testStruct.nums != INIT_SPHERE_NUM)
-        filename += "_" + std::to_string(testStruct.nums);
-    if(!testStruct.canRefract)
-        filename += "_NR";
-    filename += ".txt";
+    openResultFile((const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
     
-    FILE *df;
-    if(testStruct.doNumberTest || testStruct.doStandardTest || testStruct.doDistanceTest || testStruct.doIterationTest) {
-        df = fopen(filename.c_str(),"w");
-        if(testStruct.doStandardTest)
-            fprintf(df, "Spheres\tIterations\tDistance\tPlane\tLight Moving\tRefraction\tFrame Rate\tRay Count\n");
-        else
-            fprintf(df, "Spheres\tIterations\tDistance\tFrame Rate\tRay Count\n");
-    }
+    // Image size that the textures and buffers below are allocated for
+    GLuint targetWidth = WIDTH * MUL, targetHeight = HEIGHT * MUL;
     
-run:
-    // Positions for each spheres
-    int scale = int(cbrt(testStruct.nums));
-    for(int i = 0; i < testStruct.nums; i++) {
-        sp_pos[i] = glm::vec3(-3.0f + 1.5f * (i % scale), 0.5f + 1.5f * (i / (scale * scale)), 0.0f - 1.5f * ((i % (scale * scale)) / scale));
-    }
+    // Reallocates everything with the size of the image when a cell changes the resolution. Programs are kept.
+    auto resizeTargets = [&]() {
+        if(targetWidth == WIDTH * MUL && targetHeight == HEIGHT * MUL)
+            return;
+        targetWidth = WIDTH * MUL;
+        targetHeight = HEIGHT * MUL;
+        glBindTexture(GL_TEXTURE_2D, image);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, targetWidth, targetHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, data);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, targetWidth, targetHeight, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindTexture(GL_TEXTURE_2D, accumulation);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, targetWidth, targetHeight, 0, GL_RGBA, GL_FLOAT, NULL);
+        glBindTexture(GL_TEXTURE_2D, bounceTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8UI, targetWidth, targetHeight, 0, GL_RG_INTEGER, GL_UNSIGNED_BYTE, NULL);
+        glBindTexture(GL_TEXTURE_2D, costTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, targetWidth, targetHeight, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        rayStats.Resize(targetWidth, targetHeight);
+        if(wavefrontRenderer)
+            wavefrontRenderer->Resize(targetWidth, targetHeight);
+        if(tiles) {
+            tiles->Delete();
+            delete tiles;
+            tiles = new TileScheduler(targetWidth, targetHeight, testStruct.frameBudget);
+        }
+        if(window)
+            glfwSetWindowSize(window, WIDTH, HEIGHT);
+    };
     
-    std::cout << testStruct.nums << " Spheres" << std::endl;
-    std::cout << testStruct.iterations << " Iterations" << std::endl;
-    std::cout << "Camera Distance " << camera.Position.z << std::endl;
-    std::cout << "Has plane? " << (testStruct.withPlane ? "Yes" : "No") << std::endl;
-    std::cout << "Light moving? " << (testStruct.lightMoving ? "Yes" : "No") << std::endl;
-    std::cout << "Can refract? " << (testStruct.canRefract ? "Yes" : "No") << std::endl;
-    std::cout << "Ray calculation on? " << (testStruct.turnOffRayCalculation ? "No" : "Yes") << std::endl << std::endl;
+    // Sends the acceleration structure to its buffers. After a refit the sphere indices are unchanged and can be skipped.
+    auto uploadStructure = [&](int accel, bool indices) {
+        if(accel == ACCEL_BVH) {
+            std::vector<GLint> nodeTexels = bvh.Flatten();
+            bvhNodes.SetData(nodeTexels.empty() ? NULL : &nodeTexels[0], sizeof(GLint) * nodeTexels.size());
+            if(indices)
+                sphereIndices.SetData(bvh.Indices.empty() ? NULL : &bvh.Indices[0], sizeof(GLint) * bvh.Indices.size());
+        }
+        else if(accel == ACCEL_GRID) {
+            gridCells.SetData(&grid.CellStart[0], sizeof(GLint) * grid.CellStart.size());
+            sphereIndices.SetData(grid.Indices.empty() ? NULL : &grid.Indices[0], sizeof(GLint) * grid.Indices.size());
+        }
+    };
     
-    while (!glfwWindowShouldClose(window)) {
-        GLfloat current = glfwGetTime();
-        deltaTime = current - lastFrame;
-        lastFrame = current;
-        
-        // Clear the colorbuffer
-        glfwPollEvents();
-        do_movement();
+    // Offline mode: renders the camera path into the image texture and writes every frame as a PNG file.
+    // Rendering, readback through a ring of pixel pack buffers and encoding on the writer threads overlap.
+    // Each stage is timed on its own: GPU time of the first pass, time spent reading back, and encoding time summed
+    // over the writers. The time the render loop waits for the GPU or for a free writer buffer is reported apart.
+    auto renderPath = [&](int activeAccel, WavefrontRenderer* wavefront) {
+        GLuint width = WIDTH * MUL, height = HEIGHT * MUL;
+        float duration = cameraPath.Duration();
+        int frames = testStruct.measuredFrames > 0 ? testStruct.measuredFrames : int(duration / FIXED_TIME_STEP) + 1;
+        if(mkdir(testStruct.outputDir, 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Cannot create %s\n", testStruct.outputDir);
+            return;
+        }
+        ImageWriter writer(testStruct.writerThreads, width, height);
+        ReadbackRing frameReadback((GLsizeiptr)width * height * 4, testStruct.readbackSlots);
+        std::cout << "Rendering " << frames << " frames to " << testStruct.outputDir << " with " << frameReadback.Slots()
+                  << " readback buffers and " << writer.Threads() << " writer threads" << std::endl;
         
-        // Sum of ray count
-        float sum = 0;
+        double renderMs = 0.0, readbackMs = 0.0, gpuWaitMs = 0.0;
+        int timedFrames = 0, collected = 0;
+        auto framePath = [&](int frame) {
+            char name[32];
+            snprintf(name, sizeof(name), "/frame_%05d.png", frame);
+            return std::string(testStruct.outputDir) + name;
+        };
+        // Hands the oldest frame in the ring to the writers, waiting for the GPU if wait is true. Returns false if none was ready.
+        auto collect = [&](bool wait) {
+            double start = getTime();
+            if(!frameReadback.NextReady(wait))
+                return false;
+            gpuWaitMs += (getTime() - start) * 1000.0;
+            unsigned char* pixels = writer.Acquire();
+            start = getTime();
+            frameReadback.FetchNext(pixels);
+            readbackMs += (getTime() - start) * 1000.0;
+            writer.Submit(pixels, framePath(collected++));
+            return true;
+        };
         
-        /******************** First pass. Render to two textures attached to FBO. ********************/
-        // Bind self-created FBO
-        if(testStruct.turnOffRayCalculation)
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        else
-            glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-        
-        // Clear window
-        glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        
-        // Use the first pass shader and bind first pass VAO
-        firstPassShader.Use();
-        glBindVertexArray(first_pass_VAO);
-        
-        // Create camera transformations
-        glm::mat4 view;
-        view = camera.GetViewMatrix();
-        glm::mat4 projection = glm::perspective(camera.Zoom, (GLfloat)WIDTH / (GLfloat)HEIGHT, 0.1f, 100.0f);
-        
-        // Pass uniforms to first pass fragment shader
-        glUniform3f(glGetUniformLocation(firstPassShader.Program, "resolution"), WIDTH * MUL, HEIGHT * MUL, 0);
-        glUniform1i(glGetUniformLocation(firstPassShader.Program, "num_spheres"), testStruct.nums);
-        glUniform1i(glGetUniformLocation(firstPassShader.Program, "iterations"), testStruct.iterations);
-        glUniform3f(glGetUniformLocation(firstPassShader.Program, "viewPos"), camera.Position.x, camera.Position.y, camera.Position.z);
-        glUniform3f(glGetUniformLocation(firstPassShader.Program, "light_direction"),
-                    -1.0f + 4.0f * cos(current) * testStruct.lightMoving, 1.5f, 1.0f + 4.0f * sin(current) * testStruct.lightMoving);
-        glUniform1i(glGetUniformLocation(firstPassShader.Program, "withPlane"), testStruct.withPlane);
-        glUniform1i(glGetUniformLocation(firstPassShader.Program, "canRefract"), testStruct.canRefract);
-        double xpos, ypos;
-        glfwGetCursorPos(window, &xpos, &ypos);
-        glUniform2f(glGetUniformLocation(firstPassShader.Program, "cursor"), xpos, ypos);
-
-        //Cursor rotation matrix calculate
-        //1.3089 and 0.65 are mearsured number sutable for my machine
-        glm::vec2 mouse = (glm::vec2(xpos, ypos) / glm::vec2(WIDTH * MUL, HEIGHT * MUL) * glm::vec2(2.233) - glm::vec2(0.74)) * glm::vec2(WIDTH * MUL / (HEIGHT * MUL), 1.0) * glm::vec2(2.0);
-        glm::mat3 rot;
-        if(testStruct.doStandardTest || testStruct.doIterationTest || testStruct.doDistanceTest || testStruct.doNumberTest)
-            rot = glm::mat3(); // Identity Matrix
-        else
-            rot = glm::mat3(glm::vec3(sin(mouse.x + PI / 2.0), 0, sin(mouse.x)),glm::vec3(0, 1, 0),glm::vec3(sin(mouse.x + PI), 0, sin(mouse.x + PI / 2.0)));
-        glUniformMatrix3fv(glGetUniformLocation(firstPassShader.Program, "rot"), 1, GL_FALSE, glm::value_ptr(rot));
-
-        // Pass sphere array info to fragment shader
-        for(int i = 0; i < testStruct.nums; i++) {
-            std::string sphere = "spheres[" + std::to_string(i) + "]";
-            glUniform4f(glGetUniformLocation(firstPassShader.Program, (sphere + ".position_r").c_str()),
-                        sp_pos[i].x, sp_pos[i].y, sp_pos[i].z, 0.5f);
-            glUniform3f(glGetUniformLocation(firstPassShader.Program, (sphere + ".material.color").c_str()), 1.0f, 1.0f, 0.8f);
-            glUniform3f(glGetUniformLocation(firstPassShader.Program, (sphere + ".material.diff_spec_ref").c_str()), 1.0f, 0.5f, 1.1f);
-        }
-        
-        // Draw two triangle to cover the window and detach vertex array
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
-        
-        // No second pass if ray calculation turned off.
-        /******************** Second pass. Draw image texture to default frame buffer  ********************/
-        if(!testStruct.turnOffRayCalculation) {
-            // Bind default frame buffer
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glViewport(0, 0, width, height);
+        gpuTimer.Reset();
+        double start = getTime();
+        for(int frame = 0; frame < frames; frame++) {
+            // Frames are spread evenly over the keyframes, the yaw turns the view like the mouse does
+            CameraPath::Keyframe key = cameraPath.Sample(frames > 1 ? duration * frame / (frames - 1) : 0.0f);
+            float yaw = glm::radians(key.yaw);
+            glm::mat3 rot(glm::vec3(cos(yaw), 0.0f, sin(yaw)), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(-sin(yaw), 0.0f, cos(yaw)));
             
-            // Clear window
-            glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-            
-            // Draw Screen with image texture
-            secondPassShader.Use();
-            glBindVertexArray(second_pass_VAO);
-            glBindTexture(GL_TEXTURE_2D, image);    // Use the color attachment texture as the texture of the quad plane
-            glDrawArrays(GL_TRIANGLES, 0, 6);
-            glBindVertexArray(0);
-            
-            // Read data from data texture
-            glBindTexture(GL_TEXTURE_2D, data);
-            glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, rayRateArray);
-            glBindTexture(GL_TEXTURE_2D, 0);
-            
-            // Sum up ray calculation count
-            for(int i = 0; i < WIDTH * HEIGHT * MUL * MUL; i++) {
-                sum += rayRateArray[i];
+            gpuTimer.Start();
+            glClearBufferfv(GL_COLOR, 0, background);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            sphereBuffer.Bind(1);
+            bvhNodes.Bind(2);
+            sphereIndices.Bind(3);
+            gridCells.Bind(4);
+            if(testStruct.screenBins) {
+                if(screenBins.Update(spheres, false, key.position, rot, width, height))
+                    binTime = screenBins.BuildMs;
+                screenBins.Bind();
+            }
+            if(wavefront) {
+                RenderSettings settings;
+                settings.width = width;
+                settings.height = height;
+                settings.viewPos = key.position;
+                settings.lightDirection = key.light;
+                settings.rot = rot;
+                settings.iterations = testStruct.iterations;
+                settings.withPlane = testStruct.withPlane;
+                settings.canRefract = testStruct.canRefract;
+                settings.accel = activeAccel;
+                wavefront->Render(settings, testStruct.nums, grid, image, data);
+            }
+            else {
+                GLuint program = firstPassShader->Program;
+                firstPassShader->Use();
+                glUniform3f(glGetUniformLocation(program, "resolution"), width, height, 0);
+                glUniform1i(glGetUniformLocation(program, "num_spheres"), testStruct.nums);
+                glUniform1i(glGetUniformLocation(program, "iterations"), testStruct.iterations);
+                glUniform1i(glGetUniformLocation(program, "withPlane"), testStruct.withPlane);
+                glUniform1i(glGetUniformLocation(program, "canRefract"), testStruct.canRefract);
+                glUniform1i(glGetUniformLocation(program, "roulette"), testStruct.roulette);
+                glUniform1i(glGetUniformLocation(program, "accel"), activeAccel);
+                if(activeAccel == ACCEL_GRID)
+                    grid.SetUniforms(program);
+                glUniform3f(glGetUniformLocation(program, "viewPos"), key.position.x, key.position.y, key.position.z);
+                glUniform3f(glGetUniformLocation(program, "light_direction"), key.light.x, key.light.y, key.light.z);
+                glUniformMatrix3fv(glGetUniformLocation(program, "rot"), 1, GL_FALSE, glm::value_ptr(rot));
+                glUniform1ui(glGetUniformLocation(program, "seed"), frameSeed++);
+                if(testStruct.screenBins)
+                    screenBins.SetUniforms(program);
+                glBindVertexArray(first_pass_VAO);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+                glBindVertexArray(0);
+            }
+            for(int p = 0; p < PASS_COUNT; p++)
+                gpuTimer.Mark(p);
+            long timedFrame;
+            double passMs[PASS_COUNT];
+            if(gpuTimer.Finish(timedFrame, passMs)) {
+                renderMs += passMs[FIRST_PASS];
+                timedFrames++;
             }
             
-            // Only print when 
-            if(!testStruct.doStandardTest && !testStruct.doNumberTest && !testStruct.doDistanceTest && !testStruct.doIterationTest)
-                std::cout << int(sum * 255) << " rays per frame"<< std::endl;
+            // Synchronous readback waits for the frame right here, otherwise a full ring first hands over its oldest frame
+            if(frameReadback.Slots() == 0) {
+                unsigned char* pixels = writer.Acquire();
+                double readStart = getTime();
+                glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+                readbackMs += (getTime() - readStart) * 1000.0;
+                writer.Submit(pixels, framePath(collected++));
+                continue;
+            }
+            if(frameReadback.Pending() == frameReadback.Slots())
+                collect(true);
+            double queueStart = getTime();
+            frameReadback.Queue(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE);
+            readbackMs += (getTime() - queueStart) * 1000.0;
+            while(collect(false))
+                ;
         }
+        while(frameReadback.Pending() > 0)
+            collect(true);
+        writer.Finish();
+        double seconds = getTime() - start;
+        frameReadback.Delete();
         
-        // Swap the screen buffers
-        glfwSwapBuffers(window);
-
-        // Calculate frame rates
-        double currentTime = glfwGetTime();
-        nbFrames++;
-        if (currentTime - lastTime >= 5.0f){ // If last prinf() was more than 1 sec ago
-            // printf and reset timer
-            float fps = nbFrames/(currentTime - lastTime);
-
-            nbFrames = 0;
-            lastTime = currentTime;
+        // Each stage alone could sustain this many frames per second, the slowest one bounds the pipeline
+        double gpuMs = timedFrames > 0 ? renderMs / timedFrames : 0.0;
+        double stageFps[3] = {gpuMs > 0.0 ? 1000.0 / gpuMs : 0.0, readbackMs > 0.0 ? 1000.0 * frames / readbackMs : 0.0,
+                              writer.EncodeMs > 0.0 ? 1000.0 * frames * writer.Threads() / writer.EncodeMs : 0.0};
+        const char* stageNames[3] = {"rendering", "readback", "encoding"};
+        int bottleneck = 0;
+        for(int i = 1; i < 3; i++)
+            if(stageFps[i] > 0.0 && (stageFps[bottleneck] <= 0.0 || stageFps[i] < stageFps[bottleneck]))
+                bottleneck = i;
+        std::cout << writer.Written << " frames written in " << seconds << " s, " << writer.Written / seconds << " frames per second end to end";
+        if(writer.Failed > 0)
+            std::cout << ", " << writer.Failed << " failed";
+        std::cout << std::endl;
+        std::cout << "  Rendering " << gpuMs << " ms per frame on the GPU (" << stageFps[0] << " fps), render loop waited "
+                  << gpuWaitMs / frames << " ms per frame for it" << std::endl;
+        std::cout << "  Readback " << readbackMs / frames << " ms per frame (" << stageFps[1] << " fps)" << std::endl;
+        std::cout << "  Encoding " << writer.EncodeMs / frames << " ms per frame on one of " << writer.Threads() << " writers (" << stageFps[2]
+                  << " fps), render loop waited " << writer.StallMs / frames << " ms per frame for a free buffer" << std::endl;
+        std::cout << "Bottleneck: " << stageNames[bottleneck] << std::endl;
+    };
+    
+    // Worker of distributed rendering: draws the tiles of every batch from the coordinator with a scissor and sends back
+    // their pixels, the sums of their ray counts and how long each took, until an empty batch arrives. Tiles are timed
+    // on the wall clock up to a glFinish() instead of with queries, which a software rasterizer that only draws once
+    // the pixels are read answers with almost nothing.
+    auto serveTiles = [&](int activeAccel) {
+        GLuint width = WIDTH * MUL, height = HEIGHT * MUL;
+        GLuint program = firstPassShader->Program;
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glViewport(0, 0, width, height);
+        firstPassShader->Use();
+        glUniform3f(glGetUniformLocation(program, "resolution"), width, height, 0);
+        glUniform1i(glGetUniformLocation(program, "num_spheres"), testStruct.nums);
+        glUniform1i(glGetUniformLocation(program, "iterations"), testStruct.iterations);
+        glUniform1i(glGetUniformLocation(program, "withPlane"), testStruct.withPlane);
+        glUniform1i(glGetUniformLocation(program, "canRefract"), testStruct.canRefract);
+        glUniform1i(glGetUniformLocation(program, "roulette"), testStruct.roulette);
+        glUniform1i(glGetUniformLocation(program, "accel"), activeAccel);
+        if(activeAccel == ACCEL_GRID)
+            grid.SetUniforms(program);
+        
+        std::vector<TileJob> jobs;
+        std::vector<float> tileMs;
+        std::vector<unsigned char> pixels;
+        std::vector<GLuint> rays;
+        BatchHeader batch;
+        bool connected = coordinator.SendString((const char*)glGetString(GL_RENDERER));
+        while(connected && coordinator.Receive(&batch, sizeof(batch)) && batch.tiles > 0) {
+            jobs.resize(batch.tiles);
+            if(!coordinator.Receive(&jobs[0], sizeof(TileJob) * jobs.size()))
+                break;
+            tileMs.resize(jobs.size());
+            glm::vec3 viewPos = glm::make_vec3(batch.viewPos);
+            glm::mat3 rot = glm::make_mat3(batch.rot);
+            glUniform3f(glGetUniformLocation(program, "viewPos"), viewPos.x, viewPos.y, viewPos.z);
+            glUniform3f(glGetUniformLocation(program, "light_direction"), batch.light[0], batch.light[1], batch.light[2]);
+            glUniformMatrix3fv(glGetUniformLocation(program, "rot"), 1, GL_FALSE, batch.rot);
+            glUniform1ui(glGetUniformLocation(program, "seed"), batch.seed);
+            sphereBuffer.Bind(1);
+            bvhNodes.Bind(2);
+            sphereIndices.Bind(3);
+            gridCells.Bind(4);
+            if(testStruct.screenBins) {
+                screenBins.Update(spheres, false, viewPos, rot, width, height);
+                screenBins.SetUniforms(program);
+                screenBins.Bind();
+            }
             
+            // Tiles never overlap, one clear of the depth buffer serves the whole batch
+            glClear(GL_DEPTH_BUFFER_BIT);
+            glBindVertexArray(first_pass_VAO);
+            glEnable(GL_SCISSOR_TEST);
+            for(size_t t = 0; t < jobs.size(); t++) {
+                double tileStart = getTime();
+                glScissor(jobs[t].x, jobs[t].y, jobs[t].width, jobs[t].height);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+                glFinish();
+                tileMs[t] = float((getTime() - tileStart) * 1000.0);
+            }
+            glDisable(GL_SCISSOR_TEST);
+            glBindVertexArray(0);
             
-            if(testStruct.doDistanceTest || testStruct.doIterationTest || testStruct.doNumberTest || testStruct.doStandardTest) {
-                if(testStruct.doStandardTest)
-                    fprintf(df, "%d\t%d\t%f\t%d\t%d\t%d\t%f\t%d\n", testStruct.nums, testStruct.iterations, camera.Position.z, testStruct.withPlane, testStruct.lightMoving, testStruct.canRefract, fps, int(sum * 255));
-                else
-                    fprintf(df, "%d\t%d\t%f\t%f\t%d\n", testStruct.nums, testStruct.iterations, camera.Position.z, fps, int(sum * 255));
-                break;
-            } else {
-                std::cout << fps << " frames per second" << std::endl; // If not doing any test, print frame rate per 5 seconds
+            uint32_t count = (uint32_t)jobs.size();
+            connected = coordinator.Send(&count, sizeof(count));
+            for(size_t t = 0; t < jobs.size() && connected; t++) {
+                const TileJob& job = jobs[t];
+                TileResult result;
+                result.index = job.index;
+                result.ms = tileMs[t];
+                pixels.resize((size_t)job.width * job.height * 4);
+                rays.resize((size_t)job.width * job.height * 4);
+                glReadBuffer(GL_COLOR_ATTACHMENT0);
+                glReadPixels(job.x, job.y, job.width, job.height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+                glReadBuffer(GL_COLOR_ATTACHMENT1);
+                glReadPixels(job.x, job.y, job.width, job.height, GL_RGBA_INTEGER, GL_UNSIGNED_INT, &rays[0]);
+                for(int r = 0; r < 4; r++)
+                    result.rays[r] = 0;
+                for(size_t i = 0; i < rays.size(); i++)
+                    result.rays[i % 4] += rays[i];
+                connected = coordinator.Send(&result, sizeof(result)) && coordinator.Send(&pixels[0], pixels.size());
             }
         }
-    }
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        coordinator.Close();
+    };
     
-    if(testStruct.doStandardTest) {
-        switch(num_of_test++) {
-            case 0:
-                testStruct.withPlane = false; // Test without plane
-                break;
-            case 1:
-                testStruct.withPlane = true;
-                testStruct.lightMoving = false; // Test without moving light
-                break;
-            case 2:
-                testStruct.lightMoving = true;
-                testStruct.canRefract = false; // Test without refraction
-                break;
-            case 3:
-                testStruct.canRefract = true;
-                testStruct.turnOffRayCalculation = true; // Test without calculating ray counts
-                break;
-            case 4:
-                testStruct.withPlane = false;
-                testStruct.lightMoving = false;
-                testStruct.canRefract = false; // Disable all features
-                break;
-            default:
-                break;
+    for(size_t cell = 0; cell < cells.size(); cell++) {
+        if(window && glfwWindowShouldClose(window))
+            break;
+        applyCell(cells[cell]);
+        
+        // A mixed sweep renders the cells of the CPU backend between the GL ones, the context stays as it is
+        if(testStruct.backend == BACKEND_CPU) {
+            runCPUCell(*pool, *cpuRenderer);
+            continue;
+        }
+        resizeTargets();
+        WavefrontRenderer* wavefront = testStruct.backend == BACKEND_WAVEFRONT ? wavefrontRenderer : NULL;
+        
+        int activeAccel = buildScene();
+        
+        // Only upload when the scene changes, not every frame. A scene file goes from the mapping straight into the buffer
+        // with inline materials and is split into positions and the material table otherwise.
+        sphereBuffer.InlineMaterials = testStruct.inlineMaterials;
+        if(sceneFile.Count > 0) {
+            double uploadStart = getTime();
+            sphereBuffer.UploadTexels((const glm::vec4*)sceneFile.Records, sceneFile.Count);
+            glFinish();
+            std::cout << "Scene uploaded in " << (getTime() - uploadStart) * 1000.0 << " ms, peak RSS " << peakRSS() << " MB";
+            if(!sphereBuffer.InlineMaterials)
+                std::cout << ", " << sphereBuffer.MaterialCount << " distinct materials";
+            std::cout << std::endl;
+        }
+        else
+            sphereBuffer.Upload(spheres);
+        uploadStructure(activeAccel, true);
+        screenBins.Invalidate();
+        
+        // Compile the first pass variant before the clock starts, the sweeps reuse variants they have seen before
+        {
+            bool created = false;
+            double compileStart = getTime();
+            int loaded = Shader::Stats().Loaded;
+            firstPassShader = &firstPassVariants.Get(firstPassDefines(activeAccel), &created);
+            glGetProgramiv(firstPassShader->Program, GL_PROGRAM_BINARY_LENGTH, &firstPassBytes);
+            if(created) {
+                firstPassShader->Use();
+                glUniform1i(glGetUniformLocation(firstPassShader->Program, "spheres"), 1);
+                glUniform1i(glGetUniformLocation(firstPassShader->Program, "bvh_nodes"), 2);
+                glUniform1i(glGetUniformLocation(firstPassShader->Program, "sphere_indices"), 3);
+                glUniform1i(glGetUniformLocation(firstPassShader->Program, "grid_cells"), 4);
+                glUniform1i(glGetUniformLocation(firstPassShader->Program, "sphere_materials"), MATERIAL_INDEX_UNIT);
+                glUniform1i(glGetUniformLocation(firstPassShader->Program, "materials"), MATERIAL_UNIT);
+                glUniform1i(glGetUniformLocation(firstPassShader->Program, "tile_cells"), BIN_CELLS_UNIT);
+                glUniform1i(glGetUniformLocation(firstPassShader->Program, "tile_spheres"), BIN_SPHERES_UNIT);
+                glFinish();
+                std::cout << "First pass variant " << (Shader::Stats().Loaded > loaded ? "loaded from the binary cache" : "compiled")
+                          << " in " << (getTime() - compileStart) * 1000.0 << " ms, " << firstPassBytes << " bytes of program binary, "
+                          << firstPassVariants.Size() << " variants in memory" << std::endl;
+            }
+        }
+        
+        // Cold when any program had to be compiled from source, warm when every one came from the binary cache
+        if(!started) {
+            started = true;
+            const ShaderCacheStats& stats = Shader::Stats();
+            std::cout << (stats.Compiled > 0 ? "Cold" : "Warm") << " startup in " << (getTime() - startupStart) * 1000.0 << " ms, "
+                      << stats.Milliseconds << " ms on " << stats.Loaded + stats.Compiled << " programs (" << stats.Loaded << " from the binary cache, "
+                      << stats.Compiled << " compiled)" << std::endl;
+        }
+        
+        // Start with an empty ring, results of the previous configuration are dropped
+        rayStats.Readback.Resize(testStruct.readbackSlots);
+        
+        printSettings(activeAccel);
+        if(testStruct.pathFile) {
+            renderPath(activeAccel, wavefront);
+            continue;
+        }
+        if(testStruct.workerAddress) {
+            serveTiles(activeAccel);
+            continue;
+        }
+        rayStats.Reset();
+        accumulated = 0; // A new scene starts over
+        if(tiles)
+            tiles->Reset();
+        gpuTimer.Reset();
+        times.Reset();
+        double frameEnd = getTime();
+        clock.Start(frameEnd);
+        
+        while (testStruct.headless || !glfwWindowShouldClose(window)) {
+            GLfloat current = getTime();
+            deltaTime = current - lastFrame;
+            lastFrame = current;
+        
+            // The light follows the frame index with -frames, so every run traces the same frames
+            GLfloat animationTime = clock.Time(current);
+            bool measured = !clock.Warming();
+        
+            // With a frame budget a frame takes several iterations, each drawing some tiles and presenting the partial image
+            bool frameStart = !tiles || tiles->Starting();
+            bool frameDone = true;
+        
+            // An animated scene moves before each frame starts
+            if(testStruct.animation > 0.0f && frameStart) {
+                animateScene(animationTime, activeAccel, *pool, refitMs, rebuildMs);
+                sphereBuffer.UploadPositions(spheres);
+                uploadStructure(activeAccel, rebuildMs >= 0.0);
+            }
+        
+            // Clear the colorbuffer
+            if(!testStruct.headless) {
+                glfwPollEvents();
+                do_movement();
+            }
+        
+            /******************** First pass. Render to two textures attached to FBO. ********************/
+            // Bind self-created FBO. A headless context has no default frame buffer, so it always renders to the FBO
+            if(testStruct.turnOffRayCalculation && !testStruct.headless && !progressive && !tiles)
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            else
+                glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        
+            // Clear window, the ray statistics reduction changes the viewport. Tiles of earlier presents must stay.
+            // Only the image is cleared: glClear() is undefined on the integer ray count, bounce and cost textures, and the
+            // first pass overwrites every pixel of them anyway. The accumulation texture holds the progressive sum.
+            glViewport(0, 0, MUL * WIDTH, MUL * HEIGHT);
+            if(frameStart) {
+                gpuTimer.Start();
+                if(!progressive)
+                    glClearBufferfv(GL_COLOR, 0, background);
+                glClear(GL_DEPTH_BUFFER_BIT);
+            }
+        
+            // Use the first pass shader and bind first pass VAO
+            firstPassShader->Use();
+            glBindVertexArray(first_pass_VAO);
+        
+            // Create camera transformations
+            glm::mat4 view;
+            view = camera.GetViewMatrix();
+            glm::mat4 projection = glm::perspective(camera.Zoom, (GLfloat)WIDTH / (GLfloat)HEIGHT, 0.1f, 100.0f);
+        
+            // Pass uniforms to first pass fragment shader
+            glUniform3f(glGetUniformLocation(firstPassShader->Program, "resolution"), WIDTH * MUL, HEIGHT * MUL, 0);
+            glUniform1i(glGetUniformLocation(firstPassShader->Program, "num_spheres"), testStruct.nums);
+            glUniform1i(glGetUniformLocation(firstPassShader->Program, "iterations"), testStruct.iterations);
+            glm::vec3 lightDirection(-1.0f + 4.0f * cos(animationTime) * testStruct.lightMoving, 1.5f, 1.0f + 4.0f * sin(animationTime) * testStruct.lightMoving);
+            glUniform1i(glGetUniformLocation(firstPassShader->Program, "withPlane"), testStruct.withPlane);
+            glUniform1i(glGetUniformLocation(firstPassShader->Program, "canRefract"), testStruct.canRefract);
+            glUniform1i(glGetUniformLocation(firstPassShader->Program, "roulette"), testStruct.roulette);
+            glUniform1i(glGetUniformLocation(firstPassShader->Program, "accel"), activeAccel);
+            if(activeAccel == ACCEL_GRID)
+                grid.SetUniforms(firstPassShader->Program);
+            double xpos = 0.0, ypos = 0.0;
+            if(!testStruct.headless)
+                glfwGetCursorPos(window, &xpos, &ypos);
+            glUniform2f(glGetUniformLocation(firstPassShader->Program, "cursor"), xpos, ypos);
+
+            //Cursor rotation matrix calculate
+            //1.3089 and 0.65 are mearsured number sutable for my machine
+            glm::vec2 mouse = (glm::vec2(xpos, ypos) / glm::vec2(WIDTH * MUL, HEIGHT * MUL) * glm::vec2(2.233) - glm::vec2(0.74)) * glm::vec2(WIDTH * MUL / (HEIGHT * MUL), 1.0) * glm::vec2(2.0);
+            glm::mat3 rot;
+            if(testStruct.headless || doingTest())
+                rot = glm::mat3(); // Identity Matrix
+            else
+                rot = glm::mat3(glm::vec3(sin(mouse.x + PI / 2.0), 0, sin(mouse.x)),glm::vec3(0, 1, 0),glm::vec3(sin(mouse.x + PI), 0, sin(mouse.x + PI / 2.0)));
+        
+            // A frame spread over several presents keeps the view and light it started with, the program holds on to them
+            if(frameStart) {
+                glUniform3f(glGetUniformLocation(firstPassShader->Program, "viewPos"), camera.Position.x, camera.Position.y, camera.Position.z);
+                glUniform3f(glGetUniformLocation(firstPassShader->Program, "light_direction"), lightDirection.x, lightDirection.y, lightDirection.z);
+                glUniformMatrix3fv(glGetUniformLocation(firstPassShader->Program, "rot"), 1, GL_FALSE, glm::value_ptr(rot));
+                glUniform1ui(glGetUniformLocation(firstPassShader->Program, "seed"), frameSeed++);
+                
+                // Primary rays need the spheres binned for this view, which only changes when the camera or the spheres move
+                if(testStruct.screenBins) {
+                    if(screenBins.Update(spheres, testStruct.animation > 0.0f, camera.Position, rot, WIDTH * MUL, HEIGHT * MUL)) {
+                        binListLength = screenBins.MeanLength;
+                        binTime = screenBins.BuildMs;
+                    }
+                    screenBins.SetUniforms(firstPassShader->Program);
+                }
+            }
+
+            // Progressive mode starts over whenever the view, the light or the spheres moved and stops tracing once enough samples are summed.
+            // The first sample goes through the pixel center like without progressive mode, the others follow a Halton (2, 3) pattern.
+            bool traceFrame = true;
+            if(progressive) {
+                if(frameStart && (accumulated == 0 || testStruct.animation > 0.0f || camera.Position != lastViewPos || lightDirection != lastLight || rot != lastRot)) {
+                    GLfloat zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                    glClearBufferfv(GL_COLOR, 2, zero);
+                    accumulated = 0;
+                    progressiveStart = current;
+                    lastViewPos = camera.Position;
+                    lastLight = lightDirection;
+                    lastRot = rot;
+                }
+                traceFrame = accumulated < testStruct.progressiveSamples;
+                glm::vec2 jitter = accumulated == 0 ? glm::vec2(0.0f) : glm::vec2(halton(accumulated, 2), halton(accumulated, 3)) - glm::vec2(0.5f);
+                glUniform2f(glGetUniformLocation(firstPassShader->Program, "jitter"), jitter.x, jitter.y);
+            }
+        
+            // Sphere array info is already in the sphere buffer
+            sphereBuffer.Bind(1);
+            bvhNodes.Bind(2);
+            sphereIndices.Bind(3);
+            gridCells.Bind(4);
+            if(testStruct.screenBins)
+                screenBins.Bind();
+        
+            // Draw two triangle to cover the window and detach vertex array
+            if(wavefront) {
+                // The wavefront kernels get the same uniforms and write the same two textures
+                RenderSettings settings;
+                settings.width = WIDTH * MUL;
+                settings.height = HEIGHT * MUL;
+                settings.viewPos = camera.Position;
+                settings.lightDirection = lightDirection;
+                settings.rot = rot;
+                settings.iterations = testStruct.iterations;
+                settings.withPlane = testStruct.withPlane;
+                settings.canRefract = testStruct.canRefract;
+                settings.accel = activeAccel;
+                wavefront->Render(settings, testStruct.nums, grid, image, data);
+            }
+            else if(traceFrame && tiles)
+                frameDone = tiles->DrawSlice();
+            else if(traceFrame)
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+            glBindVertexArray(0);
+        
+            // The GPU time of a tiled frame spans all of its presents, so the passes are only marked on the last one
+            if(frameDone)
+                gpuTimer.Mark(FIRST_PASS);
+            if(progressive && traceFrame && frameDone && ++accumulated == testStruct.progressiveSamples)
+                std::cout << "Converged to " << accumulated << " samples per pixel in " << getTime() - progressiveStart << " s" << std::endl;
+        
+            // No second pass if ray calculation turned off, except for the wavefront backend, progressive mode and tiles which always render to textures
+            /******************** Second pass. Draw image texture to default frame buffer  ********************/
+            // Nothing to present in headless mode
+            if((!testStruct.turnOffRayCalculation || wavefront || progressive || tiles) && !testStruct.headless) {
+                // Bind default frame buffer
+                glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        
+                // Clear window
+                glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        
+                // Draw Screen with image texture
+                secondPassShader.Use();
+                glBindVertexArray(second_pass_VAO);
+                glBindTexture(GL_TEXTURE_2D, image);    // Use the color attachment texture as the texture of the quad plane
+                glActiveTexture(GL_TEXTURE1);
+                glBindTexture(GL_TEXTURE_2D, accumulation);    // Averaged instead of the image in progressive mode
+                glActiveTexture(GL_TEXTURE0);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+                glBindVertexArray(0);
+            }
+            if(frameDone)
+                gpuTimer.Mark(SECOND_PASS);
+        
+            // A converged progressive frame traced no rays, the counts of the last sample are kept.
+            // The data texture of a tiled frame is only complete after its last tile.
+            if(!testStruct.turnOffRayCalculation && traceFrame && frameDone) {
+                // Sum up ray calculation count on the GPU and read back the four totals of an earlier frame
+                rayStats.Reduce(data, first_pass_VAO);
+        
+                // Only print when 
+                if(rayStats.Read() && !doingTest())
+                    std::cout << rayStats.Total() << " rays per frame (" << rayStats.Totals[PRIMARY_RAY] << " primary, " << rayStats.Totals[REFLECTION_RAY] << " reflection, "
+                              << rayStats.Totals[REFRACTION_RAY] << " refraction, " << rayStats.Totals[SHADOW_RAY] << " shadow), "
+                              << rayStats.Readback.Latency << " frames old" << std::endl;
+            }
+            if(frameDone)
+                gpuTimer.Mark(RAY_STATS_PASS);
+        
+            // Swap the screen buffers. Without a swap, wait for the frame to finish so the frame rate is not just submission time.
+            // The readback ring already limits the frames in flight, so it only needs a flush.
+            double swapStart = getTime();
+            if(testStruct.headless && (testStruct.turnOffRayCalculation || testStruct.readbackSlots == 0))
+                glFinish();
+            else if(testStruct.headless)
+                glFlush();
+            else
+                glfwSwapBuffers(window);
+        
+            // A tiled frame is counted once, when its last tile has been presented
+            if(!frameDone)
+                continue;
+
+            // Calculate frame rates
+            double currentTime = getTime();
+            times.Add((currentTime - frameEnd) * 1000.0, (currentTime - swapStart) * 1000.0, measured ? clock.Repeat : -1);
+            times.SetUpdate(refitMs, rebuildMs);
+            frameEnd = currentTime;
+            long timedFrame;
+            double passMs[PASS_COUNT];
+            if(gpuTimer.Finish(timedFrame, passMs))
+                times.SetPasses(timedFrame, passMs);
+            if (clock.EndFrame(currentTime)) { // After 5 seconds or the measured frames of a repeat
+                if(clock.Fixed())
+                    std::cout << "Repeat " << clock.Repeat << ": " << clock.Fps << " frames per second" << std::endl;
+                if(!clock.Done())
+                    continue;
+        
+                if(testStruct.bounceHistogram) {
+                    bounces.Read(bounceTexture, WIDTH * MUL, HEIGHT * MUL);
+                    writeBounces(bounces);
+                }
+                if(testStruct.heatmap) {
+                    profile.Read(costTexture, WIDTH * MUL, HEIGHT * MUL);
+                    writeHeatmaps(profile);
+                }
+                if(testStruct.animation > 0.0f)
+                    printUpdate(times);
+                if(doingTest()) {
+                    writeResult(clock, rayStats.Totals, &rayStats.Readback, times, 0.0, 0);
+                    break;
+                } else {
+                    // If not doing any test, print frame rate and timings per measurement
+                    std::cout << clock.MeanFps() << " frames per second, frame time p50 " << times.Percentile(50) << " ms, p95 " << times.Percentile(95)
+                              << " ms, p99 " << times.Percentile(99) << " ms" << std::endl;
+                    if(!testStruct.turnOffRayCalculation)
+                        std::cout << "  " << rayStats.Totals[SHADOW_RAY] * clock.MeanFps() << " shadow rays per second" << std::endl;
+                    for(int p = 0; p < PASS_COUNT; p++)
+                        std::cout << "  " << passNames[p] << " " << times.MeanPass(p) << " ms" << std::endl;
+                    std::cout << "  Swap " << times.MeanSwap() << " ms" << std::endl;
+                    if(progressive)
+                        std::cout << "  " << accumulated << " of " << testStruct.progressiveSamples << " samples per pixel, "
+                                  << currentTime - progressiveStart << " s since the view last changed" << std::endl;
+                    if(tiles)
+                        std::cout << "  " << tiles->Count() << " tiles, " << tiles->Slices << " presents per frame, slowest tile "
+                                  << tiles->Slowest << " ms" << std::endl;
+                    times.Clear();
+                    clock.Start(currentTime);
+                }
+            }
         }
-        if(num_of_test <= 5)
-            goto run;
-    }
-    
-    if(testStruct.doNumberTest && num_of_test + 1 < 6) {
-        testStruct.nums = numbers[++num_of_test];
-        goto run;
-    }
-    
-    if(testStruct.doIterationTest && num_of_test + 1 < 8) {
-        testStruct.iterations = iterations[++num_of_test];
-        goto run;
-    }
-    
-    if(testStruct.doDistanceTest && num_of_test + 1 < 8) {
-        camera.Position.z = distances[++num_of_test];
-        goto run;
     }
-    
-    // Close file
-    if(df)
-        fclose(df);
+    finishTests();
     
     // Delete all arrays and buffers and free pointers
     glDeleteVertexArrays(1, &first_pass_VAO);
@@ -614,9 +2660,32 @@ run:
     glDeleteFramebuffers(1, &FBO);
     glDeleteTextures(1, &image);
     glDeleteTextures(1, &data);
-    free(rayRateArray);
+    glDeleteTextures(1, &accumulation);
+    glDeleteTextures(1, &bounceTexture);
+    glDeleteTextures(1, &costTexture);
+    sceneFile.Close();
+    firstPassVariants.Delete();
+    sphereBuffer.Delete();
+    screenBins.Delete();
+    bvhNodes.Delete();
+    sphereIndices.Delete();
+    gridCells.Delete();
+    rayStats.Delete();
+    gpuTimer.Delete();
+    if(wavefrontRenderer) {
+        wavefrontRenderer->Delete();
+        delete wavefrontRenderer;
+    }
+    if(tiles) {
+        tiles->Delete();
+        delete tiles;
+    }
+    delete cpuRenderer;
+    delete pool;
     
     // Terminate GLFW, clearing any resources allocated by GLFW.
-    glfwTerminate();
+    if(window)
+        glfwTerminate();
+    headless.Destroy();
     return 0;
 }
@@ -0,0 +1,136 @@
+#pragma once
+
+// Std. Includes
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+// Benchmark matrix read from a text file. Every line names an axis followed by its values, every combination of the
+// values is one cell. Cells are numbered with the last axis changing fastest. Empty lines and lines starting with #
+// are skipped, the values are checked by whoever applies them to a configuration.
+//   spheres 27 125 1000
+//   iterations 2 6
+//   res 640x480 1280x720
+//   backend gl cpu
+class BenchmarkMatrix
+{
+public:
+    struct Axis {
+        std::string Name;
+        std::vector<std::string> Values;
+    };
+    std::vector<Axis> Axes;
+
+    // Prints the reason and returns false if the file cannot be used
+    bool Load(const char* path)
+    {
+        this->Axes.clear();
+        std::ifstream in(path);
+        if (!in) {
+            fprintf(stderr, "Cannot open matrix file %s\n", path);
+            return false;
+        }
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(in, line)) {
+            lineNumber++;
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#')
+                continue;
+            std::istringstream fields(line);
+            Axis axis;
+            fields >> axis.Name;
+            std::string value;
+            while (fields >> value)
+                axis.Values.push_back(value);
+            if (axis.Values.empty()) {
+                fprintf(stderr, "%s:%d: axis %s has no values\n", path, lineNumber, axis.Name.c_str());
+                return false;
+            }
+            for (size_t i = 0; i < this->Axes.size(); i++)
+                if (this->Axes[i].Name == axis.Name) {
+                    fprintf(stderr, "%s:%d: axis %s is given twice\n", path, lineNumber, axis.Name.c_str());
+                    return false;
+                }
+            this->Axes.push_back(axis);
+        }
+        return true;
+    }
+
+    // Number of cells, 1 for a file without axes
+    size_t Size() const
+    {
+        size_t size = 1;
+        for (size_t i = 0; i < this->Axes.size(); i++)
+            size *= this->Axes[i].Values.size();
+        return size;
+    }
+
+    // Value of an axis in a cell
+    const std::string& Value(size_t cell, size_t axis) const
+    {
+        for (size_t i = this->Axes.size() - 1; i > axis; i--)
+            cell /= this->Axes[i].Values.size();
+        return this->Axes[axis].Values[cell % this->Axes[axis].Values.size()];
+    }
+
+    bool Has(const char* name) const
+    {
+        for (size_t i = 0; i < this->Axes.size(); i++)
+            if (this->Axes[i].Name == name)
+                return true;
+        return false;
+    }
+};
+
+// Model name of the CPU, "unknown" where it cannot be found
+inline std::string cpuName()
+{
+#ifdef __APPLE__
+    char name[256];
+    size_t size = sizeof(name);
+    if (sysctlbyname("machdep.cpu.brand_string", name, &size, NULL, 0) == 0)
+        return name;
+#else
+    std::ifstream in("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(in, line))
+        if (line.compare(0, 10, "model name") == 0 && line.find(':') != std::string::npos)
+            return line.substr(line.find_first_not_of(" \t", line.find(':') + 1));
+#endif
+    return "unknown";
+}
+
+// Compiler and the flags that change the generated code of this translation unit
+inline std::string buildFlags()
+{
+    std::string flags;
+#ifdef __VERSION__
+    flags += std::string("compiler ") + __VERSION__;
+#endif
+#ifdef __OPTIMIZE__
+    flags += ", optimized";
+#else
+    flags += ", not optimized";
+#endif
+#ifdef DEBUG
+    flags += ", DEBUG";
+#endif
+#ifdef NDEBUG
+    flags += ", NDEBUG";
+#endif
+#ifdef __AVX2__
+    flags += ", AVX2";
+#endif
+#ifdef __AVX512F__
+    flags += ", AVX-512";
+#endif
+    return flags;
+}
@@ -0,0 +1,18 @@
+#version 410 core
+
+uniform usampler2D counts;               // Per-pixel ray counts, or the row of column sums of the previous pass
+uniform ivec2     direction;             // (0, 1) to add up columns, (1, 0) to add up a row
+uniform int       texels;                // Number of texels to add up
+
+out uvec4 total;
+
+// Screen-wide ray count reduction in two passes: first over a WIDTH x 1 target adding up every column,
+// then over a 1 x 1 target adding up that row. Only the last texel has to be read back.
+void main()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    uvec4 sum = uvec4(0u);
+    for (int i = 0; i < texels; i++)
+        sum += texelFetch(counts, texel + i * direction, 0);
+    total = sum;
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <vector>
+
+// GL Includes
+#include <GL/glew.h>
+
+#include "shader.h"
+#include "readback.h"
+#include "scene.h"
+
+// Adds up the per-pixel ray counts on the GPU so that only four integers are read back per frame,
+// instead of the whole data texture. Counts are exact 32-bit integers, there is no clamping per pixel.
+// The totals go through a readback ring, so they belong to a frame Readback.Latency frames back.
+class RayStats
+{
+public:
+    GLuint Totals[4];   // Rays in the last fetched frame, indexed by Ray_Type
+    ReadbackRing Readback;
+
+    RayStats(GLuint width, GLuint height, int readbackSlots) : Readback(sizeof(GLuint) * 4, readbackSlots),
+        width(width), height(height), shader("first_pass.vs", "ray_stats.frag")
+    {
+        this->Reset();
+        this->createTarget(this->rowFBO, this->rowTexture, width, 1);
+        this->createTarget(this->totalFBO, this->totalTexture, 1, 1);
+        this->shader.Use();
+        glUniform1i(glGetUniformLocation(this->shader.Program, "counts"), 0);
+    }
+
+    // Frees the GL objects, must be called while the context is still current
+    void Delete()
+    {
+        glDeleteFramebuffers(1, &this->rowFBO);
+        glDeleteFramebuffers(1, &this->totalFBO);
+        glDeleteTextures(1, &this->rowTexture);
+        glDeleteTextures(1, &this->totalTexture);
+        glDeleteProgram(this->shader.Program);
+        this->Readback.Delete();
+    }
+
+    // Follows a new size of the count texture. The program is kept.
+    void Resize(GLuint width, GLuint height)
+    {
+        this->width = width;
+        this->height = height;
+        glBindTexture(GL_TEXTURE_2D, this->rowTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, width, 1, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Sums the count texture into one texel. quadVAO must draw a full-screen quad with 6 vertices.
+    // Leaves the viewport and frame buffer binding changed.
+    void Reduce(GLuint countTexture, GLuint quadVAO)
+    {
+        this->shader.Use();
+        glBindVertexArray(quadVAO);
+
+        // Add up every column
+        glBindFramebuffer(GL_FRAMEBUFFER, this->rowFBO);
+        glViewport(0, 0, this->width, 1);
+        glBindTexture(GL_TEXTURE_2D, countTexture);
+        glUniform2i(glGetUniformLocation(this->shader.Program, "direction"), 0, 1);
+        glUniform1i(glGetUniformLocation(this->shader.Program, "texels"), this->height);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+
+        // Add up the row of column sums
+        glBindFramebuffer(GL_FRAMEBUFFER, this->totalFBO);
+        glViewport(0, 0, 1, 1);
+        glBindTexture(GL_TEXTURE_2D, this->rowTexture);
+        glUniform2i(glGetUniformLocation(this->shader.Program, "direction"), 1, 0);
+        glUniform1i(glGetUniformLocation(this->shader.Program, "texels"), this->width);
+        glDrawArrays(GL_TRIANGLES, 0, 6);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindVertexArray(0);
+    }
+
+    // Queues the readback of the last Reduce() and updates Totals if an earlier readback has finished.
+    // Returns false if Totals did not change.
+    bool Read()
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, this->totalFBO);
+        this->Readback.Queue(0, 0, 1, 1, GL_RGBA_INTEGER, GL_UNSIGNED_INT);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        return this->Readback.Fetch(this->Totals);
+    }
+
+    // Forgets the last totals, used when ray counting is turned off
+    void Reset()
+    {
+        this->Totals[0] = this->Totals[1] = this->Totals[2] = this->Totals[3] = 0;
+    }
+
+    // All rays of every type
+    GLuint Total() const
+    {
+        return this->Totals[PRIMARY_RAY] + this->Totals[REFLECTION_RAY] + this->Totals[REFRACTION_RAY] + this->Totals[SHADOW_RAY];
+    }
+
+private:
+    GLuint width, height;
+    Shader shader;
+    GLuint rowFBO, rowTexture;
+    GLuint totalFBO, totalTexture;
+
+    void createTarget(GLuint& fbo, GLuint& texture, GLuint w, GLuint h)
+    {
+        glGenFramebuffers(1, &fbo);
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32UI, w, h, 0, GL_RGBA_INTEGER, GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::FRAMEBUFFER:: Ray statistics framebuffer is not complete!" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+};
+
+// Histogram of the path length per pixel, read from the bounce texture of the first pass. The whole texture is
+// read back synchronously, so it is only done once per measurement and never in the timed frames.
+class BounceHistogram
+{
+public:
+    std::vector<long> Pixels;       // Pixels whose path ended after this many bounces
+    std::vector<long> LowBounces;   // Bounces these pixels traced with a throughput below LOW_THROUGHPUT
+
+    // Counts the RG8UI bounce texture of the last frame
+    void Read(GLuint texture, GLuint width, GLuint height)
+    {
+        std::vector<GLubyte> texels(2 * width * height);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RG_INTEGER, GL_UNSIGNED_BYTE, &texels[0]);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+        this->Pixels.assign(1, 0);
+        this->LowBounces.assign(1, 0);
+        for (size_t i = 0; i < texels.size(); i += 2) {
+            GLubyte depth = texels[i];
+            if (depth >= this->Pixels.size()) {
+                this->Pixels.resize(depth + 1, 0);
+                this->LowBounces.resize(depth + 1, 0);
+            }
+            this->Pixels[depth]++;
+            this->LowBounces[depth] += texels[i + 1];
+        }
+    }
+
+    long TotalPixels() const
+    {
+        long total = 0;
+        for (size_t d = 0; d < this->Pixels.size(); d++)
+            total += this->Pixels[d];
+        return total;
+    }
+
+    double MeanDepth() const
+    {
+        long bounces = 0;
+        for (size_t d = 0; d < this->Pixels.size(); d++)
+            bounces += d * this->Pixels[d];
+        return this->TotalPixels() > 0 ? (double)bounces / this->TotalPixels() : 0.0;
+    }
+
+    // Share of all traced bounces that had a throughput below LOW_THROUGHPUT
+    double LowFraction() const
+    {
+        long bounces = 0, low = 0;
+        for (size_t d = 0; d < this->Pixels.size(); d++) {
+            bounces += d * this->Pixels[d];
+            low += this->LowBounces[d];
+        }
+        return bounces > 0 ? (double)low / bounces : 0.0;
+    }
+};
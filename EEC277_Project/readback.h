@@ -0,0 +1,165 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <cstring>
+
+// GL Includes
+#include <GL/glew.h>
+
+// Ring of pixel pack buffers for reading frame buffer data back without stalling the pipeline.
+// Queue() starts a glReadPixels into the next buffer and puts a fence behind it, Fetch() copies out the oldest
+// result once its fence has signaled. Results therefore arrive a few frames late instead of forcing a full
+// CPU/GPU sync every frame. The ring only blocks when every buffer is still in flight.
+// With 0 slots it falls back to a plain synchronous glReadPixels, for comparison.
+class ReadbackRing
+{
+public:
+    long Latency;       // Frames between queueing the last fetched result and fetching it
+    long MaxLatency;    // Largest latency seen since the last Resize()
+
+    ReadbackRing(GLsizeiptr size, int slots) : Latency(0), MaxLatency(0), size(size), hasResult(false), frame(0), oldest(0), pending(0)
+    {
+        this->Resize(slots);
+    }
+
+    // Frees the GL objects, must be called while the context is still current
+    void Delete()
+    {
+        for (size_t i = 0; i < this->slots.size(); i++) {
+            if (this->slots[i].fence)
+                glDeleteSync(this->slots[i].fence);
+            glDeleteBuffers(1, &this->slots[i].buffer);
+        }
+        this->slots.clear();
+        this->pending = 0;
+    }
+
+    // Drops everything in flight and changes the number of buffers
+    void Resize(int slots)
+    {
+        this->Delete();
+        this->slots.resize(slots > 0 ? slots : 0);
+        for (size_t i = 0; i < this->slots.size(); i++) {
+            glGenBuffers(1, &this->slots[i].buffer);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, this->slots[i].buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, this->size, NULL, GL_STREAM_READ);
+            this->slots[i].fence = 0;
+            this->slots[i].frame = 0;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        this->latest.assign(this->size, 0);
+        this->hasResult = false;
+        this->oldest = 0;
+        this->Latency = this->MaxLatency = 0;
+    }
+
+    // Number of buffers, 0 means synchronous
+    int Slots() const { return (int)this->slots.size(); }
+
+    // Reads in flight
+    int Pending() const { return this->pending; }
+
+    // Reads a rectangle of the bound read frame buffer. Must be called once per frame, the frame counter advances here.
+    void Queue(GLint x, GLint y, GLsizei w, GLsizei h, GLenum format, GLenum type)
+    {
+        this->frame++;
+        if (this->slots.empty()) {
+            glReadPixels(x, y, w, h, format, type, &this->latest[0]);
+            this->Latency = 0;
+            this->hasResult = true;
+            return;
+        }
+
+        // Every buffer is in flight, wait for the oldest one
+        if (this->pending == (int)this->slots.size())
+            this->fetchOldest(true);
+
+        Slot& slot = this->slots[(this->oldest + this->pending) % this->slots.size()];
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        glReadPixels(x, y, w, h, format, type, (void*)0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.frame = this->frame;
+        this->pending++;
+    }
+
+    // Copies the newest finished result into dst without waiting. Returns false if nothing new has finished.
+    bool Fetch(void* dst)
+    {
+        while (this->pending > 0 && this->fetchOldest(false))
+            ;
+        if (!this->hasResult)
+            return false;
+        memcpy(dst, &this->latest[0], this->size);
+        this->hasResult = false;
+        return true;
+    }
+
+    // True if the oldest read in flight has finished, waits for it when wait is true.
+    // With NextReady() and FetchNext() every result is taken in order instead of only the newest, e.g. to save every frame.
+    bool NextReady(bool wait)
+    {
+        if (this->pending == 0)
+            return false;
+        GLenum status;
+        do {
+            status = glClientWaitSync(this->slots[this->oldest].fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+        } while (wait && status == GL_TIMEOUT_EXPIRED);
+        return status != GL_TIMEOUT_EXPIRED;
+    }
+
+    // Copies the oldest read in flight into dst, waiting for it if it has not finished
+    void FetchNext(void* dst)
+    {
+        if (this->pending > 0)
+            this->fetchOldest(true, dst);
+    }
+
+private:
+    struct Slot {
+        GLuint buffer;
+        GLsync fence;
+        long frame;     // Frame the read was queued in
+    };
+
+    GLsizeiptr size;
+    std::vector<Slot> slots;
+    std::vector<unsigned char> latest;  // Newest result that has arrived
+    bool hasResult;
+    long frame;
+    int oldest;     // Slot of the oldest read in flight
+    int pending;    // Reads in flight
+
+    // Maps the oldest buffer if its fence has signaled, or waits for it when wait is true, and copies it to dst
+    // or the latest result. A failed wait falls through to the map, which synchronizes on its own.
+    bool fetchOldest(bool wait, void* dst = NULL)
+    {
+        Slot& slot = this->slots[this->oldest];
+        GLenum status;
+        do {
+            status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000ull : 0);
+        } while (wait && status == GL_TIMEOUT_EXPIRED);
+        if (status == GL_TIMEOUT_EXPIRED)
+            return false;
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, this->size, GL_MAP_READ_BIT);
+        if (mapped) {
+            memcpy(dst ? dst : &this->latest[0], mapped, this->size);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        this->Latency = this->frame - slot.frame;
+        if (this->Latency > this->MaxLatency)
+            this->MaxLatency = this->Latency;
+        if (!dst)
+            this->hasResult = true;
+        this->oldest = (this->oldest + 1) % this->slots.size();
+        this->pending--;
+        return true;
+    }
+};
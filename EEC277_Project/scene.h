@@ -0,0 +1,225 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <array>
+#include <map>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+// Acceleration structures trace() can use, must match the accel uniform in first_pass.frag
+enum Accel_Type {
+    ACCEL_LINEAR,
+    ACCEL_BVH,
+    ACCEL_GRID
+};
+
+// Ray types counted by first_pass.frag, one per channel of the RGBA32UI data texture
+enum Ray_Type {
+    PRIMARY_RAY,
+    REFLECTION_RAY,
+    REFRACTION_RAY,
+    SHADOW_RAY
+};
+
+// Texels (RGBA32F) used by one sphere with the inline layout and in scene files: position_r, material color, material diff_spec_ref
+const GLint SPHERE_TEXELS = 3;
+
+// Texture units of the material indices and the material table, after the sphere and structure buffers on units 1 to 4
+const GLuint MATERIAL_INDEX_UNIT = 5;
+const GLuint MATERIAL_UNIT = 6;
+
+// Same layout as the structs in first_pass.frag
+struct Material {
+    glm::vec3 color;
+    glm::vec3 diff_spec_ref;    // Diffuse, specular and refractive index
+};
+
+struct Sphere {
+    glm::vec4 position_r;       // Center in xyz, radius in w
+    Material material;
+};
+
+// Uniforms of first_pass.frag and the wavefront kernels for one frame
+struct RenderSettings {
+    int width, height;          // Resolution in pixels
+    glm::vec3 viewPos;
+    glm::vec3 lightDirection;
+    glm::mat3 rot;
+    int iterations;
+    bool withPlane;
+    bool canRefract;
+    int accel;                  // Accel_Type
+};
+
+// Axis-aligned box helpers
+struct AABB {
+    glm::vec3 bmin;
+    glm::vec3 bmax;
+
+    AABB() : bmin(glm::vec3(1e30f)), bmax(glm::vec3(-1e30f)) {}
+    void Grow(const glm::vec3& p) { bmin = glm::min(bmin, p); bmax = glm::max(bmax, p); }
+    void Grow(const AABB& b) { bmin = glm::min(bmin, b.bmin); bmax = glm::max(bmax, b.bmax); }
+    float Area() const
+    {
+        if (bmin.x > bmax.x) return 0.0f;
+        glm::vec3 e = bmax - bmin;
+        return 2.0f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
+
+// A buffer object exposed to shaders as a buffer texture (samplerBuffer / isamplerBuffer) with the given texel format
+class TextureBuffer
+{
+public:
+    GLuint Buffer;
+    GLuint Texture;
+
+    TextureBuffer(GLenum format) : Buffer(0), Texture(0)
+    {
+        glGenBuffers(1, &this->Buffer);
+        glGenTextures(1, &this->Texture);
+        glBindBuffer(GL_TEXTURE_BUFFER, this->Buffer);
+        glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::vec4), NULL, GL_STATIC_DRAW);
+        glBindTexture(GL_TEXTURE_BUFFER, this->Texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, this->Buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // Frees the GL objects, must be called while the context is still current
+    void Delete()
+    {
+        glDeleteTextures(1, &this->Texture);
+        glDeleteBuffers(1, &this->Buffer);
+    }
+
+    // Replaces the whole buffer content
+    void SetData(const void* data, GLsizeiptr size)
+    {
+        // Orphan the old storage so the driver doesn't wait for frames still reading it
+        glBindBuffer(GL_TEXTURE_BUFFER, this->Buffer);
+        glBufferData(GL_TEXTURE_BUFFER, size > 0 ? size : (GLsizeiptr)sizeof(glm::vec4), NULL, GL_STATIC_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    // Binds the buffer texture to the given texture unit
+    void Bind(GLuint unit)
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, this->Texture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+};
+
+// Sphere array stored in a texture buffer object, read in the shader with texelFetch() on a samplerBuffer.
+// Unlike the old uniform array there is no 4096-component limit, only GL_MAX_TEXTURE_BUFFER_SIZE.
+// Data is only sent to the GPU when Upload() is called, not every frame.
+// The default layout keeps one texel per sphere, position_r, with the radius negated for spheres without diffuse and
+// specular that are never hit. Materials are deduplicated into a table of two texels each, color and diff_spec_ref,
+// and an R32I buffer holds the table index of every sphere. With InlineMaterials every sphere carries its material
+// in SPHERE_TEXELS texels instead, which is what first_pass.frag compiled with INLINE_MATERIALS reads.
+class SphereBuffer : public TextureBuffer
+{
+public:
+    GLsizei Count;
+    GLsizei MaterialCount;      // Entries in the material table
+    bool InlineMaterials;       // Set before uploading
+    TextureBuffer MaterialIndices, Materials;
+
+    SphereBuffer() : TextureBuffer(GL_RGBA32F), Count(0), MaterialCount(0), InlineMaterials(false),
+        MaterialIndices(GL_R32I), Materials(GL_RGBA32F) {}
+
+    // Frees the GL objects, must be called while the context is still current
+    void Delete()
+    {
+        TextureBuffer::Delete();
+        this->MaterialIndices.Delete();
+        this->Materials.Delete();
+    }
+
+    // Largest number of spheres the implementation can hold in one texture buffer with the given layout
+    static GLint MaxSpheres(bool inlineMaterials)
+    {
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        return inlineMaterials ? maxTexels / SPHERE_TEXELS : maxTexels;
+    }
+
+    // Binds the spheres to the given texture unit, the material indices and table to their own units
+    void Bind(GLuint unit)
+    {
+        TextureBuffer::Bind(unit);
+        this->MaterialIndices.Bind(MATERIAL_INDEX_UNIT);
+        this->Materials.Bind(MATERIAL_UNIT);
+    }
+
+    // Packs the spheres and replaces the whole buffer content
+    void Upload(const std::vector<Sphere>& spheres)
+    {
+        std::vector<glm::vec4> texels(spheres.size() * SPHERE_TEXELS);
+        for (size_t i = 0; i < spheres.size(); i++) {
+            texels[i * SPHERE_TEXELS + 0] = spheres[i].position_r;
+            texels[i * SPHERE_TEXELS + 1] = glm::vec4(spheres[i].material.color, 0.0f);
+            texels[i * SPHERE_TEXELS + 2] = glm::vec4(spheres[i].material.diff_spec_ref, 0.0f);
+        }
+        this->UploadTexels(texels.empty() ? NULL : &texels[0], (GLsizei)spheres.size());
+    }
+
+    // Replaces the whole buffer content with spheres packed like scene file records, SPHERE_TEXELS texels each.
+    // The inline layout takes them as they are, the table layout splits off and deduplicates the materials.
+    void UploadTexels(const glm::vec4* texels, GLsizei count)
+    {
+        this->Count = count;
+        if (this->InlineMaterials) {
+            this->SetData(texels, sizeof(glm::vec4) * SPHERE_TEXELS * count);
+            return;
+        }
+        std::vector<glm::vec4> positions(count);
+        std::vector<GLint> indices(count);
+        std::vector<glm::vec4> table;
+        std::map<std::array<float, 6>, GLint> known;
+        for (GLsizei i = 0; i < count; i++) {
+            const glm::vec4* record = texels + (size_t)i * SPHERE_TEXELS;
+            std::array<float, 6> key = {{record[1].x, record[1].y, record[1].z, record[2].x, record[2].y, record[2].z}};
+            std::map<std::array<float, 6>, GLint>::iterator it = known.find(key);
+            if (it == known.end()) {
+                it = known.insert(std::make_pair(key, (GLint)known.size())).first;
+                table.push_back(glm::vec4(glm::vec3(record[1]), 0.0f));
+                table.push_back(glm::vec4(glm::vec3(record[2]), 0.0f));
+            }
+            indices[i] = it->second;
+            positions[i] = packPosition(record[0], glm::vec3(record[2]));
+        }
+        this->MaterialCount = (GLsizei)known.size();
+        this->SetData(count > 0 ? &positions[0] : NULL, sizeof(glm::vec4) * count);
+        this->MaterialIndices.SetData(count > 0 ? &indices[0] : NULL, sizeof(GLint) * count);
+        this->Materials.SetData(table.empty() ? NULL : &table[0], sizeof(glm::vec4) * table.size());
+    }
+
+    // Replaces only the positions after the spheres moved, their materials must be the ones uploaded last.
+    // The table layout sends a third of the data Upload() would, one texel per sphere instead of three.
+    void UploadPositions(const std::vector<Sphere>& spheres)
+    {
+        if (this->InlineMaterials) {
+            this->Upload(spheres);
+            return;
+        }
+        std::vector<glm::vec4> positions(spheres.size());
+        for (size_t i = 0; i < spheres.size(); i++)
+            positions[i] = packPosition(spheres[i].position_r, spheres[i].material.diff_spec_ref);
+        this->SetData(positions.empty() ? NULL : &positions[0], sizeof(glm::vec4) * positions.size());
+    }
+
+private:
+    // Same visibility test as the inline layout does per hit, decided once here
+    static glm::vec4 packPosition(const glm::vec4& position_r, const glm::vec3& diff_spec_ref)
+    {
+        bool visible = diff_spec_ref[0] > 0.0f || diff_spec_ref[1] > 0.0f;
+        return glm::vec4(glm::vec3(position_r), visible ? position_r.w : -position_r.w);
+    }
+};
@@ -0,0 +1,100 @@
+// Converts a text scene to the binary scene format of scene_file.h, which main loads with -scene.
+//   scene_convert in.txt out.scene       Converts a text scene
+//   scene_convert -random N out.scene    Writes N random spheres with random materials, for load tests
+// Text format: one sphere per line, "x y z radius r g b diffuse specular refraction".
+// Empty lines and lines starting with # are skipped. A refraction of 0 makes an opaque sphere.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cmath>
+
+#include "scene_file.h"
+
+// Appends one sphere record in the layout of the sphere buffer
+void addSphere(std::vector<float>& records, const float v[10])
+{
+    const float record[SCENE_FLOATS_PER_SPHERE] = {v[0], v[1], v[2], v[3], v[4], v[5], v[6], 0.0f, v[7], v[8], v[9], 0.0f};
+    records.insert(records.end(), record, record + SCENE_FLOATS_PER_SPHERE);
+}
+
+bool readText(const char* path, std::vector<float>& records)
+{
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "Cannot open %s\n", path);
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        size_t first = line.find_first_not_of(" \t\r");
+        if (first == std::string::npos || line[first] == '#')
+            continue;
+        std::istringstream fields(line);
+        float v[10];
+        for (int i = 0; i < 10; i++)
+            if (!(fields >> v[i])) {
+                fprintf(stderr, "%s:%d: expected x y z radius r g b diffuse specular refraction\n", path, lineNumber);
+                return false;
+            }
+        if (v[3] <= 0.0f) {
+            fprintf(stderr, "%s:%d: radius must be positive\n", path, lineNumber);
+            return false;
+        }
+        addSphere(records, v);
+    }
+    return true;
+}
+
+// Spheres in a cube that grows with the count so the density stays the same, above the plane at y = 0.
+// The seed is fixed, so every run writes the same scene.
+void randomScene(long count, std::vector<float>& records)
+{
+    std::mt19937 rng(277);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float side = 1.5f * cbrt((float)count);
+    records.reserve(count * SCENE_FLOATS_PER_SPHERE);
+    for (long i = 0; i < count; i++) {
+        float radius = 0.2f + 0.3f * unit(rng);
+        float v[10] = {side * (unit(rng) - 0.5f), radius + side * unit(rng), -side * unit(rng), radius,
+                       0.2f + 0.8f * unit(rng), 0.2f + 0.8f * unit(rng), 0.2f + 0.8f * unit(rng),
+                       1.0f, 0.2f + 0.6f * unit(rng), unit(rng) < 0.3f ? 1.1f + 0.4f * unit(rng) : 0.0f};
+        addSphere(records, v);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<float> records;
+    if (argc == 4 && strcmp(argv[1], "-random") == 0) {
+        long count = atol(argv[2]);
+        if (count <= 0) {
+            fprintf(stderr, "Invalid number of spheres\n");
+            return EXIT_FAILURE;
+        }
+        randomScene(count, records);
+    }
+    else if (argc == 3) {
+        if (!readText(argv[1], records))
+            return EXIT_FAILURE;
+    }
+    else {
+        fprintf(stderr, " %s usage:\n  %s in.txt out.scene\n  %s -random N out.scene\n", argv[0], argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    const char* out = argv[argc - 1];
+    if (!SceneFile::Write(out, records)) {
+        fprintf(stderr, "Cannot write %s\n", out);
+        return EXIT_FAILURE;
+    }
+    std::cout << records.size() / SCENE_FLOATS_PER_SPHERE << " spheres written to " << out << std::endl;
+    return 0;
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+// Std. Includes
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <chrono>
+
+// System Includes
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Binary scene file. A 16 byte header is followed by one record per sphere in the inline texel layout of the sphere
+// buffer, so with -layout inline the mapped records go to glBufferData() as they are, without touching every sphere
+// on the CPU. The material table layout reads them once to split off the materials.
+//   char[4]    magic "RTSP"
+//   uint32     version
+//   uint32     number of spheres
+//   uint32     floats per sphere record, 12 in version 1
+//   float[12]  per sphere: center xyz, radius, color rgb, 0, diffuse, specular, refractive index, 0
+// Values are stored in the byte order of the machine that wrote the file, which is little endian everywhere we run.
+const char     SCENE_MAGIC[4] = {'R', 'T', 'S', 'P'};
+const uint32_t SCENE_VERSION = 1;
+const uint32_t SCENE_FLOATS_PER_SPHERE = 12;
+
+struct SceneHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t floatsPerSphere;
+};
+
+// A scene file mapped read-only into memory. Records stay valid until Close().
+class SceneFile
+{
+public:
+    uint32_t Count;         // Spheres in the file, 0 if none is open
+    const float* Records;   // SCENE_FLOATS_PER_SPHERE floats per sphere
+    double LoadMs;          // Time spent opening, mapping and checking the file
+
+    SceneFile() : Count(0), Records(NULL), LoadMs(0.0), mapping(MAP_FAILED), size(0) {}
+
+    // Maps the file and checks the header. Prints the reason and returns false if it cannot be used.
+    bool Open(const char* path)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        this->Close();
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Cannot open scene file %s\n", path);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SceneHeader)) {
+            fprintf(stderr, "Scene file %s is too short\n", path);
+            close(fd);
+            return false;
+        }
+        this->size = st.st_size;
+        this->mapping = mmap(NULL, this->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd); // The mapping keeps the file alive
+        if (this->mapping == MAP_FAILED) {
+            fprintf(stderr, "Cannot map scene file %s\n", path);
+            return false;
+        }
+        madvise(this->mapping, this->size, MADV_SEQUENTIAL);
+
+        const SceneHeader* header = (const SceneHeader*)this->mapping;
+        if (memcmp(header->magic, SCENE_MAGIC, 4) != 0 || header->version != SCENE_VERSION || header->floatsPerSphere != SCENE_FLOATS_PER_SPHERE) {
+            fprintf(stderr, "%s is not a version %u scene file\n", path, SCENE_VERSION);
+            this->Close();
+            return false;
+        }
+        if (this->size != sizeof(SceneHeader) + (size_t)header->count * SCENE_FLOATS_PER_SPHERE * sizeof(float)) {
+            fprintf(stderr, "Scene file %s is truncated\n", path);
+            this->Close();
+            return false;
+        }
+        this->Count = header->count;
+        this->Records = (const float*)(header + 1);
+        this->LoadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return true;
+    }
+
+    // Unmaps the file
+    void Close()
+    {
+        if (this->mapping != MAP_FAILED)
+            munmap(this->mapping, this->size);
+        this->mapping = MAP_FAILED;
+        this->size = 0;
+        this->Count = 0;
+        this->Records = NULL;
+    }
+
+    // Writes records of SCENE_FLOATS_PER_SPHERE floats each. Returns false if the file cannot be written.
+    static bool Write(const char* path, const std::vector<float>& records)
+    {
+        FILE* f = fopen(path, "wb");
+        if (!f)
+            return false;
+        SceneHeader header;
+        memcpy(header.magic, SCENE_MAGIC, 4);
+        header.version = SCENE_VERSION;
+        header.count = (uint32_t)(records.size() / SCENE_FLOATS_PER_SPHERE);
+        header.floatsPerSphere = SCENE_FLOATS_PER_SPHERE;
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+        if (ok && !records.empty())
+            ok = fwrite(&records[0], sizeof(float), records.size(), f) == records.size();
+        return fclose(f) == 0 && ok;
+    }
+
+private:
+    void* mapping;
+    size_t size;
+};
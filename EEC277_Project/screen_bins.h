@@ -0,0 +1,153 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "scene.h"
+
+const GLint SCREEN_BIN_SIZE = 16;       // Pixels along the side of a screen tile, SCREEN_BINS in first_pass.frag
+
+// Texture units of the tile ranges and the binned sphere indices, after the material table
+const GLuint BIN_CELLS_UNIT = 7;
+const GLuint BIN_SPHERES_UNIT = 8;
+
+// Lists per screen tile the spheres a primary ray through one of its pixels can hit, so the first pass compiled with
+// SCREEN_BINS only tests those for the first bounce. The lists are built on the CPU with the counting sort of the
+// uniform grid and sent to two R32I buffer textures: the first entry of every tile plus one past the end, and the
+// sphere indices. The camera of first_pass.frag is a pinhole looking down -z with a focal length of one image height.
+class ScreenBins
+{
+public:
+    GLint Columns, Rows;
+    double MeanLength;      // Spheres per tile, averaged over the tiles of the last build
+    double BuildMs;         // CPU time of the last build including the upload
+    long Builds;
+
+    ScreenBins() : Columns(0), Rows(0), MeanLength(0.0), BuildMs(0.0), Builds(0), cells(GL_R32I), indices(GL_R32I),
+        width(0), height(0), stale(true) {}
+
+    // Frees the GL objects, must be called while the context is still current
+    void Delete()
+    {
+        this->cells.Delete();
+        this->indices.Delete();
+    }
+
+    // The next Update() rebuilds, call after the spheres were replaced
+    void Invalidate()
+    {
+        this->stale = true;
+    }
+
+    // Rebuilds the lists when the view or the image size changed since the last build, or when moved says the spheres did.
+    // Returns true if it rebuilt them.
+    bool Update(const std::vector<Sphere>& spheres, bool moved, const glm::vec3& viewPos, const glm::mat3& rot, GLuint width, GLuint height)
+    {
+        if (!moved && !this->stale && viewPos == this->viewPos && rot == this->rot && width == this->width && height == this->height)
+            return false;
+        this->stale = false;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        this->viewPos = viewPos;
+        this->rot = rot;
+        this->width = width;
+        this->height = height;
+        this->Columns = (width + SCREEN_BIN_SIZE - 1) / SCREEN_BIN_SIZE;
+        this->Rows = (height + SCREEN_BIN_SIZE - 1) / SCREEN_BIN_SIZE;
+        int tiles = this->Columns * this->Rows;
+
+        // Tile rectangle of every sphere first, then count, prefix sum and scatter
+        std::vector<TileRect> rects(spheres.size());
+        std::vector<GLint> first(tiles + 1, 0);
+        for (size_t i = 0; i < spheres.size(); i++) {
+            rects[i] = this->tileRect(spheres[i]);
+            for (int y = rects[i].y0; y <= rects[i].y1; y++)
+                for (int x = rects[i].x0; x <= rects[i].x1; x++)
+                    first[x + this->Columns * y + 1]++;
+        }
+        for (int t = 0; t < tiles; t++)
+            first[t + 1] += first[t];
+        std::vector<GLint> list(first[tiles]);
+        std::vector<GLint> next(first.begin(), first.end() - 1);
+        for (size_t i = 0; i < spheres.size(); i++)
+            for (int y = rects[i].y0; y <= rects[i].y1; y++)
+                for (int x = rects[i].x0; x <= rects[i].x1; x++)
+                    list[next[x + this->Columns * y]++] = (GLint)i;
+
+        this->cells.SetData(&first[0], sizeof(GLint) * first.size());
+        this->indices.SetData(list.empty() ? NULL : &list[0], sizeof(GLint) * list.size());
+        this->MeanLength = tiles > 0 ? (double)list.size() / tiles : 0.0;
+        this->BuildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        this->Builds++;
+        return true;
+    }
+
+    void Bind()
+    {
+        this->cells.Bind(BIN_CELLS_UNIT);
+        this->indices.Bind(BIN_SPHERES_UNIT);
+    }
+
+    void SetUniforms(GLuint program)
+    {
+        glUniform1i(glGetUniformLocation(program, "tile_columns"), this->Columns);
+    }
+
+private:
+    // Inclusive range of tiles, empty when x1 < x0
+    struct TileRect {
+        int x0, y0, x1, y1;
+    };
+
+    TextureBuffer cells, indices;
+    glm::vec3 viewPos;
+    glm::mat3 rot;
+    GLuint width, height;
+    bool stale;
+
+    // Tiles covered by the projection of a sphere. None for spheres that are never hit or lie behind the camera,
+    // all for spheres that reach the camera plane.
+    TileRect tileRect(const Sphere& sphere) const
+    {
+        TileRect none = {0, 0, -1, -1}, all = {0, 0, this->Columns - 1, this->Rows - 1};
+        if (!(sphere.material.diff_spec_ref[0] > 0.0f || sphere.material.diff_spec_ref[1] > 0.0f))
+            return none;
+        glm::vec3 p = glm::transpose(this->rot) * (glm::vec3(sphere.position_r) - this->viewPos);
+        float r = sphere.position_r.w;
+        float depth = -p.z;
+        if (depth + r <= 0.0f)
+            return none;
+        if (depth - r <= 1e-3f * r)
+            return all;
+
+        // Tangents from the camera to the circle the sphere leaves in the xz and yz planes bound its image
+        float h = (float)this->height;
+        float xMin, xMax, yMin, yMax;
+        tangents(p.x, depth, r, xMin, xMax);
+        tangents(p.y, depth, r, yMin, yMax);
+        // uv = (fragCoord - resolution / 2) / height, a pixel of margin covers the jitter of progressive samples
+        glm::vec2 lo = glm::vec2(xMin, yMin) * h + glm::vec2(this->width, this->height) * 0.5f - glm::vec2(1.0f);
+        glm::vec2 hi = glm::vec2(xMax, yMax) * h + glm::vec2(this->width, this->height) * 0.5f + glm::vec2(1.0f);
+        if (hi.x < 0.0f || hi.y < 0.0f || lo.x >= this->width || lo.y >= this->height)
+            return none;
+        lo = glm::max(lo, glm::vec2(0.0f));
+        hi = glm::min(hi, glm::vec2(this->width - 1, this->height - 1));
+        TileRect rect = {int(lo.x) / SCREEN_BIN_SIZE, int(lo.y) / SCREEN_BIN_SIZE, int(hi.x) / SCREEN_BIN_SIZE, int(hi.y) / SCREEN_BIN_SIZE};
+        return rect;
+    }
+
+    // Slopes x / depth of the two tangents from the origin to a circle at (x, depth) with radius r, depth > r
+    static void tangents(float x, float depth, float r, float& lo, float& hi)
+    {
+        float d2 = depth * depth - r * r;
+        float s = r * std::sqrt(x * x + d2);
+        lo = (x * depth - s) / d2;
+        hi = (x * depth + s) / d2;
+    }
+};
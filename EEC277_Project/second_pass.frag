@@ -3,8 +3,16 @@ in vec2 TexCoords;
 
 out vec4 color;
 uniform sampler2D texture1;
+uniform sampler2D accumulation;     // Sum of the progressive samples, sample count in alpha
+uniform bool progressive;
+
+const float gamma = 2.2;
 
 void main()
 {
-    color = texture(texture1, TexCoords);
+    if (progressive) {
+        vec4 sum = texture(accumulation, TexCoords);
+        color = vec4(pow(sum.rgb / max(sum.a, 1.0), vec3(1.0 / gamma)), 1.0);
+    } else
+        color = texture(texture1, TexCoords);
 }
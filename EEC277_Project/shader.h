@@ -7,53 +7,41 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <vector>
+#include <chrono>
+#include <cstdio>
+#include <sys/stat.h>
+
+// Programs loaded from the binary cache and compiled from source since startup, with the time spent on both
+struct ShaderCacheStats {
+    int Loaded;
+    int Compiled;
+    double Milliseconds;
+};
 
 class Shader
 {
 public:
     GLuint Program;
-    // Constructor generates the shader on the fly
-    Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const GLchar* geometryPath = nullptr)
+    // Constructor generates the shader on the fly. defines is inserted after the #version line of every stage.
+    // The linked program is stored in CacheDirectory() and loaded from there next time if nothing changed.
+    Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const GLchar* geometryPath = nullptr, const std::string& defines = "")
     {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         // 1. Retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
+        std::string vertexCode = injectDefines(readSource(vertexPath), defines);
+        std::string fragmentCode = injectDefines(readSource(fragmentPath), defines);
         std::string geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensures ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // Open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // Read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // Convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-			// If geometry shader path is present, also load a geometry shader
-			if(geometryPath != nullptr)
-			{
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-				gShaderStream << gShaderFile.rdbuf();
-				gShaderFile.close();
-				geometryCode = gShaderStream.str();
-			}
-        }
-        catch (std::ifstream::failure e)
+		// If geometry shader path is present, also load a geometry shader
+		if(geometryPath != nullptr)
+			geometryCode = injectDefines(readSource(geometryPath), defines);
+        std::string cacheFile = cachePath(std::string(vertexPath) + "|" + fragmentPath + "|" + (geometryPath ? geometryPath : "") + "|" + defines);
+        unsigned long long sourceHash = hashSource(vertexCode + "|" + fragmentCode + "|" + geometryCode);
+        if(this->loadBinary(cacheFile, sourceHash))
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            finishStats(start, true);
+            return;
         }
         const GLchar* vShaderCode = vertexCode.c_str();
         const GLchar * fShaderCode = fragmentCode.c_str();
@@ -87,19 +75,175 @@ public:
         glAttachShader(this->Program, fragment);
 		if(geometryPath != nullptr)
 			glAttachShader(this->Program, geometry);
+        glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(this->Program);
         checkCompileErrors(this->Program, "PROGRAM");
+        this->saveBinary(cacheFile, sourceHash);
         // Delete the shaders as they're linked into our program now and no longer necessery
         glDeleteShader(vertex);
         glDeleteShader(fragment);
 		if(geometryPath != nullptr)
 			glDeleteShader(geometry);
-
+        finishStats(start, false);
+    }
+    // Constructor for a compute shader program, needs OpenGL 4.3
+    Shader(const GLchar* computePath)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::string computeCode = readSource(computePath);
+        std::string cacheFile = cachePath(computePath);
+        unsigned long long sourceHash = hashSource(computeCode);
+        if(this->loadBinary(cacheFile, sourceHash))
+        {
+            finishStats(start, true);
+            return;
+        }
+        const GLchar* cShaderCode = computeCode.c_str();
+        GLuint compute = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(compute, 1, &cShaderCode, NULL);
+        glCompileShader(compute);
+        checkCompileErrors(compute, "COMPUTE");
+        this->Program = glCreateProgram();
+        glAttachShader(this->Program, compute);
+        glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(this->Program);
+        checkCompileErrors(this->Program, "PROGRAM");
+        this->saveBinary(cacheFile, sourceHash);
+        glDeleteShader(compute);
+        finishStats(start, false);
     }
     // Uses the current shader
     void Use() { glUseProgram(this->Program); }
 
+    // Where program binaries are kept, relative to the working directory. Empty turns the cache off.
+    static std::string& CacheDirectory()
+    {
+        static std::string directory = "shader_cache";
+        return directory;
+    }
+
+    static ShaderCacheStats& Stats()
+    {
+        static ShaderCacheStats stats = {0, 0, 0.0};
+        return stats;
+    }
+
 private:
+    // Reads a shader file. A line #include "file" is replaced by the contents of that file,
+    // which is looked up relative to the working directory like the shader paths themselves.
+    static std::string readSource(const std::string& path)
+    {
+        std::ifstream shaderFile(path.c_str());
+        if(!shaderFile)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ: " << path << std::endl;
+            return "";
+        }
+        std::stringstream source;
+        std::string line;
+        while(std::getline(shaderFile, line))
+        {
+            if(line.compare(0, 10, "#include \"") == 0)
+                source << readSource(line.substr(10, line.find('"', 10) - 10));
+            else
+                source << line << "\n";
+        }
+        return source.str();
+    }
+
+    // 64-bit FNV-1a
+    static unsigned long long hash(const std::string& text)
+    {
+        unsigned long long h = 14695981039346656037ULL;
+        for(size_t i = 0; i < text.size(); i++)
+            h = (h ^ (unsigned char)text[i]) * 1099511628211ULL;
+        return h;
+    }
+
+    // A binary is only valid for the exact source and the driver that produced it, so both go into the hash
+    static unsigned long long hashSource(const std::string& source)
+    {
+        return hash(source + "|" + (const char*)glGetString(GL_RENDERER) + "|" + (const char*)glGetString(GL_VERSION));
+    }
+
+    // One file per program and defines. A changed source or driver overwrites the entry instead of adding one.
+    static std::string cachePath(const std::string& name)
+    {
+        if(CacheDirectory().empty())
+            return "";
+        char file[32];
+        snprintf(file, sizeof(file), "/%016llx.bin", hash(name));
+        return CacheDirectory() + file;
+    }
+
+    static void finishStats(std::chrono::steady_clock::time_point start, bool loaded)
+    {
+        (loaded ? Stats().Loaded : Stats().Compiled)++;
+        Stats().Milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Creates the program from a cached binary. Returns false if there is none, it is stale or the driver rejects it.
+    bool loadBinary(const std::string& file, unsigned long long sourceHash)
+    {
+        if(file.empty())
+            return false;
+        std::ifstream in(file.c_str(), std::ios::binary);
+        unsigned long long storedHash = 0;
+        GLenum format = 0;
+        GLint length = 0;
+        in.read((char*)&storedHash, sizeof(storedHash));
+        in.read((char*)&format, sizeof(format));
+        in.read((char*)&length, sizeof(length));
+        if(!in || storedHash != sourceHash || length <= 0)
+            return false;
+        std::vector<char> binary(length);
+        if(!in.read(&binary[0], length))
+            return false;
+
+        // The hint must be set again, or GL_PROGRAM_BINARY_LENGTH of a cached program may read 0
+        this->Program = glCreateProgram();
+        glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glProgramBinary(this->Program, format, &binary[0], length);
+        GLint success = 0;
+        glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+        if(!success)
+        {
+            glDeleteProgram(this->Program);
+            return false;
+        }
+        return true;
+    }
+
+    // Stores the linked program, does nothing if the driver offers no binary format
+    void saveBinary(const std::string& file, unsigned long long sourceHash)
+    {
+        GLint formats = 0, length = 0, success = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+        glGetProgramiv(this->Program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if(file.empty() || formats <= 0 || !success || length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(this->Program, length, &length, &format, &binary[0]);
+
+        mkdir(CacheDirectory().c_str(), 0755);
+        std::ofstream out(file.c_str(), std::ios::binary | std::ios::trunc);
+        out.write((const char*)&sourceHash, sizeof(sourceHash));
+        out.write((const char*)&format, sizeof(format));
+        out.write((const char*)&length, sizeof(length));
+        out.write(&binary[0], length);
+    }
+
+    // #define lines have to follow #version, which must stay the first line
+    static std::string injectDefines(const std::string& code, const std::string& defines)
+    {
+        if(defines.empty())
+            return code;
+        size_t start = code.compare(0, 8, "#version") == 0 ? code.find('\n') + 1 : 0;
+        return code.substr(0, start) + defines + code.substr(start);
+    }
+
     void checkCompileErrors(GLuint shader, std::string type)
 	{
 		GLint success;
@@ -125,4 +269,43 @@ private:
 	}
 };
 
+// Programs built from the same vertex and fragment shader with different blocks of #define lines.
+// Each variant is compiled the first time it is asked for and kept until Delete().
+class ShaderVariants
+{
+public:
+    ShaderVariants(const std::string& vertexPath, const std::string& fragmentPath) : vertexPath(vertexPath), fragmentPath(fragmentPath) {}
+
+    // Returns the program for these defines. created is set to true if it had to be compiled now.
+    Shader& Get(const std::string& defines, bool* created = nullptr)
+    {
+        std::map<std::string, Shader*>::iterator it = this->variants.find(defines);
+        if(created)
+            *created = it == this->variants.end();
+        if(it != this->variants.end())
+            return *it->second;
+        Shader* shader = new Shader(this->vertexPath.c_str(), this->fragmentPath.c_str(), nullptr, defines);
+        this->variants[defines] = shader;
+        return *shader;
+    }
+
+    // Number of compiled variants
+    size_t Size() const { return this->variants.size(); }
+
+    // Frees every program, must be called while the context is still current
+    void Delete()
+    {
+        for(std::map<std::string, Shader*>::iterator it = this->variants.begin(); it != this->variants.end(); ++it)
+        {
+            glDeleteProgram(it->second->Program);
+            delete it->second;
+        }
+        this->variants.clear();
+    }
+
+private:
+    std::string vertexPath, fragmentPath;
+    std::map<std::string, Shader*> variants;
+};
+
 #endif
\ No newline at end of file
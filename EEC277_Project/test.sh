@@ -5,4 +5,27 @@ make
 ./main -nt -r # Number test with no refraction
 ./main -it # Do iteration test
 ./main -it -r # Iteration test with no refraction
-./main -dt # Do distance tests
\ No newline at end of file
+./main -dt # Do distance tests
+./main -st --headless # Standard test without a display (EGL surfaceless)
+./main -nt --headless -res 640x480 # Headless number test at a smaller resolution
+./main -st -n 100000 --headless -frames 20 -warmup 2 -repeat 1 # 100k spheres, only limited by GL_MAX_TEXTURE_BUFFER_SIZE
+./main -nt -accel bvh # Number test up to 100k spheres, linear vs BVH with speedup and crossover
+./main -nt -accel grid # Same with the uniform grid, reports the grid resolution per sphere count
+./main -rbt # Readback test, synchronous vs 1-4 pixel pack buffers with latency and speedup
+./main -st -backend cpu # Standard test on the CPU backend, no GPU or GL context needed, adds rays per second per core
+make bench && ./intersect_bench # Ray-sphere kernel microbenchmark, scalar vs SSE/AVX2/AVX-512, writes IntersectBench.txt
+./main -st --headless -m # Every test also writes Standard_Frames.txt, per-frame times with GPU time per pass from timestamp queries
+./main -it -frames 300 -warmup 30 -repeat 5 # Deterministic iteration test, light animated by frame index, mean and stddev of 5 repeats
+./main -it -backend wavefront # Iteration test on the wavefront compute-shader path (OpenGL 4.3), compare with IterationTest.txt
+./main -st -backend gl -m # Shadow rays per second with a fixed light, compare with the moving light rows of -st
+./main -it -m -progressive 256 --headless -frames 300 -warmup 0 -repeat 1 # Accumulates up to 256 jittered samples per pixel, prints the convergence time
+./main -st -i 16 -budget 8 --headless -frames 30 -warmup 5 -repeat 1 # Deep iterations in 128x128 tiles, 8 ms of first pass per present
+./main -it -bounces && ./main -it -bounces -roulette # Bounce depth histograms with the fixed cutoff and with Russian roulette, IterationTest_Bounces.txt vs IterationTest_Roulette_Bounces.txt
+make scenes && ./scene_convert -random 1000000 million.scene && ./main -st -scene million.scene -accel bvh --headless -frames 10 -warmup 2 -repeat 1 # 1M spheres from a scene file, prints load and upload time and peak RSS
+./main -st -accel bvh -n 10000 -animate 0.5 -rebuild 1.3 -frames 300 -warmup 10 -repeat 1 --headless # Moving spheres, BVH refitted per frame and rebuilt past 1.3x SAH cost
+./main -matrix matrix_example.txt --headless -frames 100 -warmup 10 -repeat 3 # Every combination of the axes in matrix_example.txt in one process, one row per cell in matrix_example.csv with GL renderer, CPU and build flags in its header
+./main -path camera_path_example.txt -frames 360 -res 1920x1080 --headless -writers 8 # Offline camera path to frames/frame_*.png, pipelined readback and writer threads, reports end to end fps and the bottleneck stage
+./main -st -heatmap --headless -frames 10 -warmup 2 -repeat 1 # Per-pixel rays, sphere tests, bounces and shader clock of every run as Standard_Heatmap_<run>_*.png, per 32 px tile in Standard_Tiles.txt
+./main -matrix layout_matrix.txt --headless -frames 100 -warmup 10 -repeat 3 # Material table against inline materials per accel and sphere count, frame rate and program binary size per row in layout_matrix.csv
+./main -nt -bin --headless -frames 50 -warmup 5 -repeat 3 # Primary rays only test the spheres binned to their 16x16 tile, NumberTest_Binned.txt adds the mean tile list length and binning time per sphere count
+./main -distribute 4 -frames 50 -warmup 5 -repeat 3 # 64x64 tiles over 1 to 4 local worker processes, speedup and efficiency in DistributedTest.txt
@@ -0,0 +1,120 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <condition_variable>
+
+// Fixed set of worker threads with one task queue each. Run() deals the tasks out round-robin, every worker
+// takes from the front of its own queue and, once that is empty, steals from the back of the others.
+// Tiles near the top of the screen (sky) are much cheaper than tiles over the spheres, stealing evens that out.
+class ThreadPool
+{
+public:
+    // 0 threads uses one per hardware thread
+    ThreadPool(int threads) : queues(nullptr), job(nullptr), remaining(0), generation(0), stop(false)
+    {
+        if (threads <= 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+        this->queues.reset(new Queue[threads]);
+        for (int i = 0; i < threads; i++)
+            this->threads.push_back(std::thread(&ThreadPool::worker, this, i));
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->lock);
+            this->stop = true;
+        }
+        this->start.notify_all();
+        for (size_t i = 0; i < this->threads.size(); i++)
+            this->threads[i].join();
+    }
+
+    int Size() const { return (int)this->threads.size(); }
+
+    // Calls job(task, worker) for every task in [0, tasks) and returns when all of them are done
+    void Run(int tasks, const std::function<void(int, int)>& job)
+    {
+        if (tasks <= 0)
+            return;
+        // Workers still looking for work from the last Run() may pick up new tasks early, so set the job first
+        this->job = &job;
+        this->remaining = tasks;
+        for (int t = 0; t < tasks; t++) {
+            Queue& q = this->queues[t % this->threads.size()];
+            std::lock_guard<std::mutex> guard(q.lock);
+            q.tasks.push_back(t);
+        }
+
+        std::unique_lock<std::mutex> guard(this->lock);
+        this->generation++;
+        this->start.notify_all();
+        this->done.wait(guard, [this] { return this->remaining == 0; });
+    }
+
+private:
+    struct Queue {
+        std::mutex lock;
+        std::deque<int> tasks;
+    };
+
+    std::vector<std::thread> threads;
+    std::unique_ptr<Queue[]> queues;
+    const std::function<void(int, int)>* job;
+    std::atomic<int> remaining;     // Tasks of the current Run() not finished yet
+    std::mutex lock;
+    std::condition_variable start, done;
+    long generation;                // Advances once per Run()
+    bool stop;
+
+    // Own queue first, then the others starting with the next worker
+    bool takeTask(int id, int& task)
+    {
+        int n = (int)this->threads.size();
+        for (int i = 0; i < n; i++) {
+            Queue& q = this->queues[(id + i) % n];
+            std::lock_guard<std::mutex> guard(q.lock);
+            if (q.tasks.empty())
+                continue;
+            if (i == 0) {
+                task = q.tasks.front();
+                q.tasks.pop_front();
+            } else {
+                task = q.tasks.back();
+                q.tasks.pop_back();
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void worker(int id)
+    {
+        long seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(this->lock);
+                this->start.wait(guard, [&] { return this->stop || this->generation != seen; });
+                if (this->stop)
+                    return;
+                seen = this->generation;
+            }
+            int task;
+            while (this->takeTask(id, task)) {
+                (*this->job)(task, id);
+                if (--this->remaining == 0) {
+                    std::lock_guard<std::mutex> guard(this->lock);
+                    this->done.notify_all();
+                }
+            }
+        }
+    }
+};
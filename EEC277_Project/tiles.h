@@ -0,0 +1,163 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+
+// GL Includes
+#include <GL/glew.h>
+
+const GLuint SCREEN_TILE_SIZE = 128;    // Pixels along one side of a first pass tile
+
+// Estimates the cost of every tile of a new frame and orders the tiles most expensive first. costs holds the last
+// measured milliseconds of each tile, negative if never measured. Those tiles are assumed to cost the mean of the
+// measured ones, or unmeasured before any was measured, so costs ends up holding an estimate for every tile.
+inline void orderByCost(std::vector<double>& costs, double unmeasured, std::vector<int>& order)
+{
+    double sum = 0.0;
+    int measured = 0;
+    for (size_t i = 0; i < costs.size(); i++)
+        if (costs[i] >= 0.0) {
+            sum += costs[i];
+            measured++;
+        }
+    double mean = measured > 0 ? sum / measured : unmeasured;
+    for (size_t i = 0; i < costs.size(); i++)
+        if (costs[i] < 0.0)
+            costs[i] = mean;
+    order.resize(costs.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = (int)i;
+    std::stable_sort(order.begin(), order.end(), [&costs](int a, int b) { return costs[a] > costs[b]; });
+}
+
+// Spreads the first pass of one frame over several presents. The screen is split into tiles that are drawn with a
+// scissor rectangle, and each present only draws as many tiles as fit into the time budget. Every tile is timed with
+// a GL_TIME_ELAPSED query, read when the tile comes up again in the next frame, so the scheduler never waits on the GPU.
+// The most expensive tiles of the previous frame are drawn first. A tile that takes longer than the budget alone is
+// still drawn, one per present.
+class TileScheduler
+{
+public:
+    int Slices;         // Presents used by the last complete frame
+    double Slowest;     // Milliseconds of the most expensive tile of the last measured frame, -1 until one has been measured
+
+    TileScheduler(GLuint width, GLuint height, double budgetMs) : Slices(0), Slowest(-1.0), budget(budgetMs), next(0), slices(0)
+    {
+        GLuint tilesX = (width + SCREEN_TILE_SIZE - 1) / SCREEN_TILE_SIZE;
+        GLuint tilesY = (height + SCREEN_TILE_SIZE - 1) / SCREEN_TILE_SIZE;
+        for (GLuint y = 0; y < tilesY; y++)
+            for (GLuint x = 0; x < tilesX; x++) {
+                Tile t;
+                t.x = x * SCREEN_TILE_SIZE;
+                t.y = y * SCREEN_TILE_SIZE;
+                t.width = std::min(SCREEN_TILE_SIZE, width - t.x);
+                t.height = std::min(SCREEN_TILE_SIZE, height - t.y);
+                t.cost = -1.0;
+                t.pending = false;
+                glGenQueries(1, &t.query);
+                this->tiles.push_back(t);
+                this->order.push_back((int)this->tiles.size() - 1);
+            }
+    }
+
+    // Frees the GL objects, must be called while the context is still current
+    void Delete()
+    {
+        for (size_t i = 0; i < this->tiles.size(); i++)
+            glDeleteQueries(1, &this->tiles[i].query);
+    }
+
+    // Forgets the frame in progress, the next slice starts a new frame. Measured costs are kept for the order, the slowest tile is forgotten.
+    void Reset()
+    {
+        this->next = 0;
+        this->slices = 0;
+        this->Slowest = -1.0;
+    }
+
+    // True if the next DrawSlice() starts a new frame
+    bool Starting() const
+    {
+        return this->next == 0;
+    }
+
+    int Count() const
+    {
+        return (int)this->tiles.size();
+    }
+
+    // Draws the next tiles of the frame. The first pass program, its uniforms and the quad VAO must be bound.
+    // Returns true when the last tile of the frame has been drawn.
+    bool DrawSlice()
+    {
+        if (this->next == 0)
+            this->schedule();
+
+        glEnable(GL_SCISSOR_TEST);
+        double spent = 0.0;
+        while (this->next < (int)this->order.size()) {
+            Tile& t = this->tiles[this->order[this->next]];
+            double cost = this->estimates[this->order[this->next]];
+            if (spent > 0.0 && spent + cost > this->budget)
+                break;
+            spent += cost;
+            glScissor(t.x, t.y, t.width, t.height);
+            glBeginQuery(GL_TIME_ELAPSED, t.query);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            glEndQuery(GL_TIME_ELAPSED);
+            t.pending = true;
+            this->next++;
+        }
+        glDisable(GL_SCISSOR_TEST);
+
+        this->slices++;
+        if (this->next < (int)this->order.size())
+            return false;
+        this->Slices = this->slices;
+        this->Reset();
+        return true;
+    }
+
+private:
+    struct Tile {
+        GLuint x, y, width, height;
+        double cost;        // Milliseconds when last measured, negative if never
+        bool pending;       // Query issued and not read yet
+        GLuint query;
+    };
+
+    std::vector<Tile> tiles;
+    std::vector<int> order; // Tiles of the current frame, most expensive first
+    std::vector<double> estimates;  // Milliseconds every tile of the current frame is expected to take
+    double budget;
+    int next;               // Position in order of the next tile to draw
+    int slices;             // Presents of the current frame so far
+
+    // Collects the timings that have arrived and orders the tiles of the new frame by cost
+    void schedule()
+    {
+        double slowest = -1.0;
+        for (size_t i = 0; i < this->tiles.size(); i++) {
+            Tile& t = this->tiles[i];
+            if (!t.pending)
+                continue;
+            GLint available = 0;
+            glGetQueryObjectiv(t.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;   // Keeps the old cost, the query is issued again this frame
+            GLuint64 ns = 0;
+            glGetQueryObjectui64v(t.query, GL_QUERY_RESULT, &ns);
+            t.cost = ns / 1e6;
+            t.pending = false;
+            slowest = std::max(slowest, t.cost);
+        }
+        if (slowest >= 0.0)
+            this->Slowest = slowest;
+        // Before any tile was measured each one is assumed to take the whole budget
+        this->estimates.resize(this->tiles.size());
+        for (size_t i = 0; i < this->tiles.size(); i++)
+            this->estimates[i] = this->tiles[i].cost;
+        orderByCost(this->estimates, this->budget, this->order);
+    }
+};
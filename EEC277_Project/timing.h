@@ -0,0 +1,297 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+// GL Includes
+#include <GL/glew.h>
+
+// GPU work measured separately in every frame
+enum Pass_Type {
+    FIRST_PASS,
+    SECOND_PASS,
+    RAY_STATS_PASS,
+    PASS_COUNT
+};
+const char* const passNames[] = {"First Pass", "Second Pass", "Ray Statistics"};
+
+const int TIMER_FRAMES = 4;     // Frames of timestamp queries in flight before the oldest one has to be ready
+const double FIXED_TIME_STEP = 1.0 / 60.0;  // Animation seconds per frame when frames are counted instead of timed
+const double WINDOW_SECONDS = 5.0;          // Length of a measurement without a fixed frame count
+
+// Timestamp queries around the passes of a frame. Start() and Mark() only issue glQueryCounter, the results are
+// read TIMER_FRAMES frames later and only once they are available, so the timer never stalls the pipeline.
+class GPUTimer
+{
+public:
+    GPUTimer() : frame(0), resolved(0)
+    {
+        glGenQueries(TIMER_FRAMES * (PASS_COUNT + 1), &this->queries[0][0]);
+    }
+
+    // Frees the GL objects, must be called while the context is still current
+    void Delete()
+    {
+        glDeleteQueries(TIMER_FRAMES * (PASS_COUNT + 1), &this->queries[0][0]);
+    }
+
+    // Forgets the frames in flight, frame numbers start again at 0
+    void Reset()
+    {
+        this->frame = this->resolved = 0;
+    }
+
+    // Call before the first pass of a frame
+    void Start()
+    {
+        glQueryCounter(this->queries[this->frame % TIMER_FRAMES][0], GL_TIMESTAMP);
+    }
+
+    // Call after a pass, also when it was skipped
+    void Mark(int pass)
+    {
+        glQueryCounter(this->queries[this->frame % TIMER_FRAMES][pass + 1], GL_TIMESTAMP);
+    }
+
+    // Ends the frame. Returns true and fills the milliseconds of every pass of an earlier frame if one has finished.
+    bool Finish(long& resolvedFrame, double ms[PASS_COUNT])
+    {
+        this->frame++;
+
+        // The oldest set is about to be reused, so it has to be read even if that waits
+        bool full = this->frame - this->resolved >= TIMER_FRAMES;
+        if (this->resolved == this->frame)
+            return false;
+        GLuint* q = this->queries[this->resolved % TIMER_FRAMES];
+        GLint available = 0;
+        glGetQueryObjectiv(q[PASS_COUNT], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available && !full)
+            return false;
+
+        GLuint64 stamps[PASS_COUNT + 1];
+        for (int i = 0; i <= PASS_COUNT; i++)
+            glGetQueryObjectui64v(q[i], GL_QUERY_RESULT, &stamps[i]);
+        for (int i = 0; i < PASS_COUNT; i++)
+            ms[i] = (stamps[i + 1] - stamps[i]) / 1e6;
+        resolvedFrame = this->resolved++;
+        return true;
+    }
+
+private:
+    GLuint queries[TIMER_FRAMES][PASS_COUNT + 1];
+    long frame;     // Frame being recorded
+    long resolved;  // Oldest frame whose results have not been read
+};
+
+// Timing of one frame in milliseconds. Pass times stay negative until the GPU timer has read them.
+struct FrameSample {
+    int repeat;     // Repeat of the configuration, -1 for warmup frames, which are left out of every statistic
+    double frame;   // CPU time from the end of the previous frame
+    double swap;    // CPU time spent in the swap or finish
+    double pass[PASS_COUNT];
+    double refit;   // CPU time of the BVH refit of an animated scene, negative if there was none
+    double rebuild; // CPU time of the acceleration structure rebuild of an animated scene, negative if there was none
+};
+
+// Per-frame samples of one benchmark run
+class FrameTimes
+{
+public:
+    std::vector<FrameSample> Samples;
+
+    FrameTimes() : first(0) {}
+
+    // Drops the samples, frame numbers of the GPU timer keep counting
+    void Clear()
+    {
+        this->first += (long)this->Samples.size();
+        this->Samples.clear();
+    }
+
+    // Drops the samples, call together with GPUTimer::Reset()
+    void Reset()
+    {
+        this->first = 0;
+        this->Samples.clear();
+    }
+
+    void Add(double frameMs, double swapMs, int repeat)
+    {
+        FrameSample s;
+        s.repeat = repeat;
+        s.frame = frameMs;
+        s.swap = swapMs;
+        for (int i = 0; i < PASS_COUNT; i++)
+            s.pass[i] = -1.0;
+        s.refit = s.rebuild = -1.0;
+        this->Samples.push_back(s);
+    }
+
+    // Scene update times of the frame added last
+    void SetUpdate(double refitMs, double rebuildMs)
+    {
+        if (this->Samples.empty())
+            return;
+        this->Samples.back().refit = refitMs;
+        this->Samples.back().rebuild = rebuildMs;
+    }
+
+    // GPU results arrive a few frames after the frame itself
+    void SetPasses(long frame, const double ms[PASS_COUNT])
+    {
+        frame -= this->first;
+        if (frame < 0 || frame >= (long)this->Samples.size())
+            return;
+        for (int i = 0; i < PASS_COUNT; i++)
+            this->Samples[frame].pass[i] = ms[i];
+    }
+
+    // Frame time at percentile p in [0, 100], nearest rank
+    double Percentile(double p) const
+    {
+        std::vector<double> t;
+        for (size_t i = 0; i < this->Samples.size(); i++)
+            if (this->Samples[i].repeat >= 0)
+                t.push_back(this->Samples[i].frame);
+        if (t.empty())
+            return 0.0;
+        std::sort(t.begin(), t.end());
+        size_t rank = (size_t)std::ceil(p / 100.0 * t.size());
+        return t[std::min(t.size() - 1, rank > 0 ? rank - 1 : 0)];
+    }
+
+    // Mean time of a pass over the frames the GPU timer has read, negative if there are none
+    double MeanPass(int pass) const
+    {
+        double sum = 0.0;
+        int n = 0;
+        for (size_t i = 0; i < this->Samples.size(); i++)
+            if (this->Samples[i].repeat >= 0 && this->Samples[i].pass[pass] >= 0.0) {
+                sum += this->Samples[i].pass[pass];
+                n++;
+            }
+        return n > 0 ? sum / n : -1.0;
+    }
+
+    double MeanSwap() const
+    {
+        double sum = 0.0;
+        int n = 0;
+        for (size_t i = 0; i < this->Samples.size(); i++)
+            if (this->Samples[i].repeat >= 0) {
+                sum += this->Samples[i].swap;
+                n++;
+            }
+        return n > 0 ? sum / n : 0.0;
+    }
+
+    // Mean over the measured frames that refitted, negative if none did
+    double MeanRefit() const { return this->mean(&FrameSample::refit, NULL); }
+
+    // Mean over the measured frames that rebuilt, negative if none did. rebuilds is set to their number.
+    double MeanRebuild(int* rebuilds = NULL) const { return this->mean(&FrameSample::rebuild, rebuilds); }
+
+private:
+    long first;     // GPU timer frame of Samples[0]
+
+    double mean(double FrameSample::*field, int* count) const
+    {
+        double sum = 0.0;
+        int n = 0;
+        for (size_t i = 0; i < this->Samples.size(); i++)
+            if (this->Samples[i].repeat >= 0 && this->Samples[i].*field >= 0.0) {
+                sum += this->Samples[i].*field;
+                n++;
+            }
+        if (count)
+            *count = n;
+        return n > 0 ? sum / n : -1.0;
+    }
+};
+
+// Decides the animation time of every frame and when a measurement is over.
+// With a frame count, time advances FIXED_TIME_STEP per frame so every run traces the same frames: each repeat
+// renders the warmup frames, then the measured ones. Without one, time is the wall clock and every WINDOW_SECONDS
+// ends a measurement.
+class BenchmarkClock
+{
+public:
+    int Repeat;     // Measurements finished since Start()
+    float Fps;      // Frame rate of the last measurement
+    double Elapsed; // Seconds of the last measurement
+
+    BenchmarkClock(int warmupFrames, int measuredFrames, int repeats)
+        : Repeat(0), Fps(0.0f), Elapsed(0.0), warmup(warmupFrames), measured(measuredFrames), repeats(repeats),
+          frame(0), startTime(0.0), sum(0.0), sumSquares(0.0) {}
+
+    bool Fixed() const { return this->measured > 0; }
+
+    // Starts a configuration, forgets the earlier measurements
+    void Start(double now)
+    {
+        this->Repeat = 0;
+        this->frame = 0;
+        this->startTime = now;
+        this->sum = this->sumSquares = 0.0;
+    }
+
+    // Animation time of the frame about to be rendered
+    double Time(double now) const
+    {
+        return this->Fixed() ? this->frame * FIXED_TIME_STEP : now;
+    }
+
+    // True while the frame about to be rendered is not measured
+    bool Warming() const
+    {
+        return this->Fixed() && this->frame < this->warmup;
+    }
+
+    // Call after every frame. Returns true when a measurement has ended, Fps and Elapsed then describe it.
+    bool EndFrame(double now)
+    {
+        this->frame++;
+        if (this->Fixed() && this->frame == this->warmup)
+            this->startTime = now;
+        int frames = this->Fixed() ? this->frame - this->warmup : this->frame;
+        if (this->Fixed() ? frames < this->measured : now - this->startTime < WINDOW_SECONDS)
+            return false;
+
+        this->Elapsed = now - this->startTime;
+        this->Fps = frames / this->Elapsed;
+        this->sum += this->Fps;
+        this->sumSquares += double(this->Fps) * this->Fps;
+        this->Repeat++;
+        this->frame = 0;
+        this->startTime = now;
+        return true;
+    }
+
+    // All repeats of the configuration are measured. Without a frame count one measurement is enough.
+    bool Done() const
+    {
+        return this->Repeat >= (this->Fixed() ? this->repeats : 1);
+    }
+
+    double MeanFps() const
+    {
+        return this->Repeat > 0 ? this->sum / this->Repeat : 0.0;
+    }
+
+    // Sample standard deviation of the frame rate over the repeats
+    double StdDevFps() const
+    {
+        if (this->Repeat < 2)
+            return 0.0;
+        double mean = this->MeanFps();
+        return std::sqrt(std::max(0.0, (this->sumSquares - this->Repeat * mean * mean) / (this->Repeat - 1)));
+    }
+
+private:
+    int warmup, measured, repeats;
+    int frame;          // Frames since the start of this measurement, including warmup
+    double startTime;   // Wall clock at the start of this measurement
+    double sum, sumSquares;
+};
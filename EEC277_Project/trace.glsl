@@ -0,0 +1,338 @@
+// Scene description, closest-hit tracing and the shadow ray query shared by first_pass.frag and the wavefront kernels.
+// Pulled in with #include "trace.glsl", which Shader expands when it reads a file.
+
+struct Ray {
+    vec3 origin;
+    vec3 direction;
+};
+
+struct Light {
+    vec3 color;
+    vec3 direction;
+};
+
+struct Material {
+    vec3 color;
+    vec3 diff_spec_ref;
+};
+
+struct Intersect {
+    float len;
+    vec3 normal;
+    vec3 center;
+    Material material;
+};
+
+struct Sphere {
+    vec4 position_r;
+    Material material;
+};
+
+struct Plane {
+    vec3 normal;
+    Material material;
+};
+
+uniform int       num_spheres;           // Sphere number
+#ifdef INLINE_MATERIALS
+uniform samplerBuffer spheres;          // Sphere Array, 3 texels per sphere: position_r, color, diff_spec_ref
+#else
+uniform samplerBuffer spheres;          // Sphere Array, position_r per sphere, the radius is negative for spheres that are never hit
+uniform isamplerBuffer sphere_materials; // Index into materials of every sphere
+uniform samplerBuffer materials;        // Deduplicated materials, 2 texels each: color, diff_spec_ref
+#endif
+uniform vec3      light_direction;       // Light direction for static/moving light
+#ifdef WITH_PLANE
+const bool        withPlane = WITH_PLANE; // Specialized variant, the plane test is resolved at compile time
+#else
+uniform bool      withPlane;             // Has a plane or not
+#endif
+uniform int       accel;                 // Acceleration structure: 0 linear, 1 BVH, 2 uniform grid
+uniform isamplerBuffer bvh_nodes;        // BVH nodes in depth-first order, 2 texels per node
+uniform isamplerBuffer sphere_indices;   // Sphere indices referenced by BVH leaves or grid cells
+uniform isamplerBuffer grid_cells;       // First entry in sphere_indices of every grid cell, plus one past the end
+uniform vec3      grid_min;              // Grid lower corner
+uniform vec3      grid_max;              // Grid upper corner
+uniform vec3      grid_cell_size;        // Size of one cell
+uniform ivec3     grid_res;              // Number of cells along each axis
+
+const float epsilon = 1e-3;
+const float exposure = 1e-2;
+const float gamma = 2.2;
+const float intensity = 100.0;
+const vec3 ambient = vec3(0.6, 0.8, 1.0) * intensity / gamma;
+const float MAX_LEN = 2147483647.0;
+const Intersect miss = Intersect(MAX_LEN, vec3(0.0), vec3(0.0), Material(vec3(0.0), vec3(0.0)));
+Light light = Light(vec3(1.0, 1.0, 1.0) * intensity, normalize(light_direction)); // Light source, can be fixed or moving
+const int PRIMARY_RAY = 0;
+const int REFLECTION_RAY = 1;
+const int REFRACTION_RAY = 2;
+const int SHADOW_RAY = 3;
+
+// Specialized variants know a power of two above num_spheres, which gives the linear loop a constant trip count bound
+#ifdef SPHERE_BUCKET
+#define FOR_EACH_SPHERE(i) for (int i = 0; i < SPHERE_BUCKET && i < num_spheres; i++)
+#else
+#define FOR_EACH_SPHERE(i) for (int i = 0; i < num_spheres; i++)
+#endif
+
+// The profiling variant counts the sphere tests of the invocation for the cost texture, all others compile the count away
+#ifdef PROFILE
+uint sphereTests = 0u;
+#define COUNT_SPHERE_TEST() sphereTests++
+#else
+#define COUNT_SPHERE_TEST()
+#endif
+
+#ifdef INLINE_MATERIALS
+// Layout before the material table, kept as a variant to compare against (-layout inline). Every test reads the whole
+// sphere and the closest hit so far carries its normal, center and material through the traversal.
+#define HitRecord Intersect
+const Intersect noHit = miss;
+
+Sphere getSphere(int i) {
+    return Sphere(texelFetch(spheres, 3 * i), Material(texelFetch(spheres, 3 * i + 1).xyz, texelFetch(spheres, 3 * i + 2).xyz));
+}
+
+Intersect intersect(Ray ray, Sphere sphere) {
+    vec3 oc = sphere.position_r.xyz - ray.origin;
+    float l = dot(ray.direction, oc);
+    float det = l * l - dot(oc, oc) + sphere.position_r.w * sphere.position_r.w;
+    if (det < 0.0) return miss;
+    
+    float len = l - sqrt(det);
+    if (len < 0.0) len = l + sqrt(det);
+    if (len < 0.0) return miss;
+    return Intersect(len, normalize(ray.origin + len*ray.direction - sphere.position_r.xyz), sphere.position_r.xyz, sphere.material); // Normalized, grazing hits are not exactly on the surface
+}
+
+Intersect intersect(Ray ray, Plane plane) {
+    float len = -dot(ray.origin, plane.normal) / dot(ray.direction, plane.normal);
+    if (len < 0.0) return miss;
+    return Intersect(len, plane.normal, vec3(0.0), plane.material);
+}
+
+void testSphere(Ray ray, int i, inout Intersect intersection) {
+    COUNT_SPHERE_TEST();
+    Sphere s = getSphere(i);
+    if(dot(ray.direction, s.position_r.xyz - ray.origin) >= 0) { // Prune those spheres at the back of the ray origin
+        Intersect sphere = intersect(ray, s);
+        if ((sphere.material.diff_spec_ref[0] > 0.0 || sphere.material.diff_spec_ref[1] > 0.0)  && sphere.len < intersection.len) // If hit and in front of the last test hit
+            intersection = sphere;
+    }
+}
+
+void testPlane(Ray ray, inout Intersect intersection) {
+    Intersect plane = intersect(ray, Plane(vec3(0, 1, 0), Material(vec3(1.0, 1.0, 1.0), vec3(0.5, 0.5, 0.0))));
+    if (length(plane.material.diff_spec_ref)> 0.0) { intersection = plane; }
+}
+
+Intersect resolve(Ray ray, Intersect intersection) {
+    return intersection;
+}
+
+bool blocks(Ray ray, int i) { // testSphere() without the hit record, any hit counts
+    COUNT_SPHERE_TEST();
+    vec4 position_r = texelFetch(spheres, 3 * i);
+    vec3 oc = position_r.xyz - ray.origin;
+    float l = dot(ray.direction, oc);
+    if (l < 0.0) return false; // Pruned like in testSphere(), in front of the origin the far hit is never behind it
+    float det = l * l - dot(oc, oc) + position_r.w * position_r.w;
+    if (det < 0.0) return false;
+    vec3 diff_spec_ref = texelFetch(spheres, 3 * i + 2).xyz;
+    return diff_spec_ref[0] > 0.0 || diff_spec_ref[1] > 0.0;
+}
+#else
+// Closest hit so far, only its distance and what was hit. resolve() fetches normal and material once at the end.
+struct HitRecord {
+    float len;
+    int id;                              // Sphere index, PLANE_ID or NO_ID
+};
+const int NO_ID = -1;
+const int PLANE_ID = -2;
+const HitRecord noHit = HitRecord(MAX_LEN, NO_ID);
+
+void testSphere(Ray ray, int i, inout HitRecord intersection) {
+    COUNT_SPHERE_TEST();
+    vec4 position_r = texelFetch(spheres, i);
+    vec3 oc = position_r.xyz - ray.origin;
+    float l = dot(ray.direction, oc);
+    if (l < 0.0) return; // Prune those spheres at the back of the ray origin
+    float det = l * l - dot(oc, oc) + position_r.w * position_r.w;
+    if (det < 0.0) return;
+    float len = l - sqrt(det);
+    if (len < 0.0) len = l + sqrt(det);
+    if (len >= 0.0 && position_r.w > 0.0 && len < intersection.len) // If hit, visible and in front of the last test hit
+        intersection = HitRecord(len, i);
+}
+
+void testPlane(Ray ray, inout HitRecord intersection) {
+    if (!(-ray.origin.y / ray.direction.y < 0.0)) intersection = HitRecord(-ray.origin.y / ray.direction.y, PLANE_ID);
+}
+
+Intersect resolve(Ray ray, HitRecord hit) {
+    if (hit.id == NO_ID) return miss;
+    if (hit.id == PLANE_ID) return Intersect(hit.len, vec3(0, 1, 0), vec3(0.0), Material(vec3(1.0, 1.0, 1.0), vec3(0.5, 0.5, 0.0)));
+    vec3 center = texelFetch(spheres, hit.id).xyz;
+    int m = texelFetch(sphere_materials, hit.id).x;
+    Material material = Material(texelFetch(materials, 2 * m).xyz, texelFetch(materials, 2 * m + 1).xyz);
+    return Intersect(hit.len, normalize(ray.origin + hit.len * ray.direction - center), center, material); // Normalized, grazing hits are not exactly on the surface
+}
+
+bool blocks(Ray ray, int i) { // testSphere() without the hit record, any hit counts
+    COUNT_SPHERE_TEST();
+    vec4 position_r = texelFetch(spheres, i);
+    vec3 oc = position_r.xyz - ray.origin;
+    float l = dot(ray.direction, oc);
+    if (l < 0.0) return false; // Pruned like in testSphere(), in front of the origin the far hit is never behind it
+    float det = l * l - dot(oc, oc) + position_r.w * position_r.w;
+    return det >= 0.0 && position_r.w > 0.0;
+}
+#endif
+
+bool hitBox(Ray ray, vec3 invDir, vec3 bmin, vec3 bmax, float maxLen) { // Slab test, only counts boxes closer than maxLen
+    vec3 t0 = (bmin - ray.origin) * invDir;
+    vec3 t1 = (bmax - ray.origin) * invDir;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float enter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+    float exit = min(min(tFar.x, tFar.y), min(tFar.z, maxLen));
+    return enter <= exit;
+}
+
+void traceBVH(Ray ray, inout HitRecord intersection) { // Stackless traversal using the escape index of every node
+    vec3 invDir = 1.0 / ray.direction;
+    int node = 0;
+    while (node >= 0) {
+        ivec4 lo = texelFetch(bvh_nodes, 2 * node);
+        ivec4 hi = texelFetch(bvh_nodes, 2 * node + 1);
+        int count = hi.w & 7;
+        if (hitBox(ray, invDir, intBitsToFloat(lo.xyz), intBitsToFloat(hi.xyz), intersection.len)) {
+            if (count == 0) { // Interior node, the first child follows directly
+                node++;
+                continue;
+            }
+            int first = hi.w >> 3;
+            for (int i = 0; i < count; i++)
+                testSphere(ray, texelFetch(sphere_indices, first + i).x, intersection);
+        }
+        node = lo.w;
+    }
+}
+
+void traceGrid(Ray ray, inout HitRecord intersection) { // 3D-DDA, visits the cells along the ray front to back
+    vec3 invDir = 1.0 / ray.direction;
+    vec3 t0 = (grid_min - ray.origin) * invDir;
+    vec3 t1 = (grid_max - ray.origin) * invDir;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float enter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+    float exit = min(min(tFar.x, tFar.y), min(tFar.z, intersection.len));
+    if (enter > exit) return;
+
+    vec3 p = ray.origin + enter * ray.direction;
+    ivec3 cell = clamp(ivec3(floor((p - grid_min) / grid_cell_size)), ivec3(0), grid_res - 1);
+    ivec3 stepDir = ivec3(sign(ray.direction));
+    vec3 next = (grid_min + (vec3(cell) + step(0.0, ray.direction)) * grid_cell_size - ray.origin) * invDir; // Distance to the next cell boundary on each axis
+    vec3 delta = abs(grid_cell_size * invDir);
+
+    while (true) {
+        int c = cell.x + grid_res.x * (cell.y + grid_res.y * cell.z);
+        int end = texelFetch(grid_cells, c + 1).x;
+        for (int i = texelFetch(grid_cells, c).x; i < end; i++)
+            testSphere(ray, texelFetch(sphere_indices, i).x, intersection);
+
+        float cellExit = min(next.x, min(next.y, next.z));
+        if (intersection.len <= cellExit) break; // Nothing in later cells can be closer
+
+        if (next.x < next.y) {
+            if (next.x < next.z) { cell.x += stepDir.x; next.x += delta.x; }
+            else { cell.z += stepDir.z; next.z += delta.z; }
+        } else {
+            if (next.y < next.z) { cell.y += stepDir.y; next.y += delta.y; }
+            else { cell.z += stepDir.z; next.z += delta.z; }
+        }
+        if (any(lessThan(cell, ivec3(0))) || any(greaterThanEqual(cell, grid_res))) break;
+    }
+}
+
+Intersect trace(Ray ray) {
+    HitRecord intersection = noHit;
+    if (withPlane) testPlane(ray, intersection);
+    if (accel == 1) {
+        if (num_spheres > 0) traceBVH(ray, intersection);
+    } else if (accel == 2) {
+        if (num_spheres > 0) traceGrid(ray, intersection);
+    } else {
+        FOR_EACH_SPHERE(i)
+            testSphere(ray, i, intersection);
+    }
+    return resolve(ray, intersection);
+}
+
+bool occludedBVH(Ray ray) { // traceBVH() without shrinking the boxes to the closest hit, leaves at the first blocker
+    vec3 invDir = 1.0 / ray.direction;
+    int node = 0;
+    while (node >= 0) {
+        ivec4 lo = texelFetch(bvh_nodes, 2 * node);
+        ivec4 hi = texelFetch(bvh_nodes, 2 * node + 1);
+        int count = hi.w & 7;
+        if (hitBox(ray, invDir, intBitsToFloat(lo.xyz), intBitsToFloat(hi.xyz), MAX_LEN)) {
+            if (count == 0) {
+                node++;
+                continue;
+            }
+            int first = hi.w >> 3;
+            for (int i = 0; i < count; i++)
+                if (blocks(ray, texelFetch(sphere_indices, first + i).x)) return true;
+        }
+        node = lo.w;
+    }
+    return false;
+}
+
+bool occludedGrid(Ray ray) { // traceGrid() that leaves at the first blocker instead of finishing the cell
+    vec3 invDir = 1.0 / ray.direction;
+    vec3 t0 = (grid_min - ray.origin) * invDir;
+    vec3 t1 = (grid_max - ray.origin) * invDir;
+    vec3 tNear = min(t0, t1);
+    vec3 tFar = max(t0, t1);
+    float enter = max(max(tNear.x, tNear.y), max(tNear.z, 0.0));
+    float exit = min(min(tFar.x, tFar.y), min(tFar.z, MAX_LEN));
+    if (enter > exit) return false;
+
+    vec3 p = ray.origin + enter * ray.direction;
+    ivec3 cell = clamp(ivec3(floor((p - grid_min) / grid_cell_size)), ivec3(0), grid_res - 1);
+    ivec3 stepDir = ivec3(sign(ray.direction));
+    vec3 next = (grid_min + (vec3(cell) + step(0.0, ray.direction)) * grid_cell_size - ray.origin) * invDir;
+    vec3 delta = abs(grid_cell_size * invDir);
+
+    while (true) {
+        int c = cell.x + grid_res.x * (cell.y + grid_res.y * cell.z);
+        int end = texelFetch(grid_cells, c + 1).x;
+        for (int i = texelFetch(grid_cells, c).x; i < end; i++)
+            if (blocks(ray, texelFetch(sphere_indices, i).x)) return true;
+
+        if (next.x < next.y) {
+            if (next.x < next.z) { cell.x += stepDir.x; next.x += delta.x; }
+            else { cell.z += stepDir.z; next.z += delta.z; }
+        } else {
+            if (next.y < next.z) { cell.y += stepDir.y; next.y += delta.y; }
+            else { cell.z += stepDir.z; next.z += delta.z; }
+        }
+        if (any(lessThan(cell, ivec3(0))) || any(greaterThanEqual(cell, grid_res))) return false;
+    }
+}
+
+bool occluded(Ray ray) { // Any-hit query for shadow rays, same answer as trace(ray) != miss
+    if (withPlane && !(-ray.origin.y / ray.direction.y < 0.0)) return true; // intersect(ray, Plane(vec3(0, 1, 0), ...)) did not miss
+    if (accel == 1) {
+        if (num_spheres > 0) return occludedBVH(ray);
+    } else if (accel == 2) {
+        if (num_spheres > 0) return occludedGrid(ray);
+    } else {
+        FOR_EACH_SPHERE(i)
+            if (blocks(ray, i)) return true;
+    }
+    return false;
+}
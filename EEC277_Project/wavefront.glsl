@@ -0,0 +1,54 @@
+// Buffers shared by the wavefront kernels. Every queue is a count followed by its entries. Kernels append with
+// atomicAdd on the count, so each queue only holds live work and the next dispatch runs exactly that many invocations.
+// Pixel and slot numbers are stored in the w components with intBitsToFloat.
+
+layout(local_size_x = 64) in;            // WAVEFRONT_GROUP_SIZE in wavefront.h
+
+struct Path {                            // One per pixel, the state radiance() keeps in registers between bounces
+    vec4 origin_type;                    // Ray to trace next and its Ray_Type
+    vec4 direction;
+    vec4 mask;                           // Accumulated fresnel mask
+    vec4 color;                          // Radiance gathered so far
+};
+
+struct Hit {                             // Closest hit of the path ray, Intersect without the nesting
+    vec4 normal_len;
+    vec4 center;
+    vec4 color;
+    vec4 diff_spec_ref;
+};
+
+struct SecondaryRay {                    // Reflection or inner refraction ray of a refractive hit, traced once
+    vec4 origin_pixel;
+    vec4 direction_slot;                 // Slot in contributions that receives its light
+    vec4 shadow_direction;               // Direction used to place its shadow ray, see radiance()
+    vec4 mask;
+    vec4 transmit;                       // 1 - fresnel of the surface it leaves
+};
+
+struct ShadowRay {
+    vec4 origin_pixel;
+    vec4 direction_slot;
+    vec4 contribution;                   // Light added to the slot if nothing is in the way
+};
+
+layout(std430, binding = 0) buffer Dispatch { uint dispatch_args[9]; };         // Indirect groups of the path, secondary and shadow queues
+layout(std430, binding = 1) buffer Paths { Path paths[]; };
+layout(std430, binding = 2) buffer Hits { Hit hits[]; };
+layout(std430, binding = 3) buffer PathQueue { uint count; uint pixels[]; } path_queue;        // Paths traced this bounce
+layout(std430, binding = 4) buffer NextPathQueue { uint count; uint pixels[]; } next_queue;    // Paths traced next bounce
+layout(std430, binding = 5) buffer SecondaryQueue { uint count; SecondaryRay rays[]; } secondary_queue;
+layout(std430, binding = 6) buffer ShadowQueue { uint count; ShadowRay rays[]; } shadow_queue;
+layout(std430, binding = 7) buffer Contributions { vec4 contributions[]; };   // 3 slots per pixel, added to the path color in order
+layout(std430, binding = 8) buffer RayCounts { uint ray_counts[]; };          // 4 per pixel, indexed by Ray_Type
+
+uniform int       pixels;                // Width * height
+
+// Adds the slots filled since the last bounce in the order radiance() adds them, and empties them
+vec3 gather(int pixel, vec3 color) {
+    for (int slot = 0; slot < 3; slot++) {
+        color += contributions[3 * pixel + slot].xyz;
+        contributions[3 * pixel + slot] = vec4(0.0);
+    }
+    return color;
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <utility>
+
+// GL Includes
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "shader.h"
+#include "scene.h"
+#include "grid.h"
+
+const GLuint WAVEFRONT_GROUP_SIZE = 64;     // local_size_x in wavefront.glsl
+
+// Bindings of the shader storage buffers declared in wavefront.glsl
+enum Wavefront_Buffer {
+    WF_DISPATCH,
+    WF_PATHS,
+    WF_HITS,
+    WF_PATH_QUEUE,
+    WF_NEXT_QUEUE,
+    WF_SECONDARY_QUEUE,
+    WF_SHADOW_QUEUE,
+    WF_CONTRIBUTIONS,
+    WF_RAY_COUNTS,
+    WF_BUFFER_COUNT
+};
+
+// Byte sizes of the structs in wavefront.glsl, std430 with only vec4 members
+const GLsizeiptr WF_PATH_SIZE = 4 * sizeof(glm::vec4);
+const GLsizeiptr WF_HIT_SIZE = 4 * sizeof(glm::vec4);
+const GLsizeiptr WF_SECONDARY_SIZE = 5 * sizeof(glm::vec4);
+const GLsizeiptr WF_SHADOW_SIZE = 3 * sizeof(glm::vec4);
+
+// Renders the same image as first_pass.frag with separate compute dispatches instead of one radiance() loop per pixel.
+// Every bounce runs closest hit (extend), shading, the secondary rays of refractive hits and the shadow rays over queues
+// that only hold live work, so diffuse and refractive pixels no longer share a warp and no kernel keeps the whole path
+// state in registers. Queue sizes stay on the GPU and are turned into indirect dispatches, nothing is read back.
+// Needs OpenGL 4.3. Writes the image and data textures of the first pass, so the second pass and RayStats are unchanged.
+class WavefrontRenderer
+{
+public:
+    WavefrontRenderer(GLuint width, GLuint height) : pixels(width * height),
+        generate("wavefront_generate.comp"), extend("wavefront_extend.comp"), shade("wavefront_shade.comp"),
+        secondary("wavefront_secondary.comp"), shadow("wavefront_shadow.comp"), prepare("wavefront_prepare.comp"),
+        resolve("wavefront_resolve.comp")
+    {
+        glGenBuffers(WF_BUFFER_COUNT, this->buffers);
+        this->allocate();
+
+        // Same texture units as the first pass
+        Shader* programs[] = {&this->generate, &this->extend, &this->shade, &this->secondary, &this->shadow, &this->prepare, &this->resolve};
+        for (int i = 0; i < 7; i++) {
+            programs[i]->Use();
+            glUniform1i(glGetUniformLocation(programs[i]->Program, "spheres"), 1);
+            glUniform1i(glGetUniformLocation(programs[i]->Program, "bvh_nodes"), 2);
+            glUniform1i(glGetUniformLocation(programs[i]->Program, "sphere_indices"), 3);
+            glUniform1i(glGetUniformLocation(programs[i]->Program, "grid_cells"), 4);
+            glUniform1i(glGetUniformLocation(programs[i]->Program, "sphere_materials"), MATERIAL_INDEX_UNIT);
+            glUniform1i(glGetUniformLocation(programs[i]->Program, "materials"), MATERIAL_UNIT);
+        }
+    }
+
+    // Frees the GL objects, must be called while the context is still current
+    void Delete()
+    {
+        glDeleteBuffers(WF_BUFFER_COUNT, this->buffers);
+        Shader* programs[] = {&this->generate, &this->extend, &this->shade, &this->secondary, &this->shadow, &this->prepare, &this->resolve};
+        for (int i = 0; i < 7; i++)
+            glDeleteProgram(programs[i]->Program);
+    }
+
+    // Reallocates the buffers for a new image size, the programs are kept
+    void Resize(GLuint width, GLuint height)
+    {
+        this->pixels = width * height;
+        this->allocate();
+    }
+
+    // Renders one frame into image (RGBA8) and data (RGBA32UI). The sphere, BVH and grid buffers must be bound
+    // to texture units 1-4 like for the first pass, grid is only read when settings.accel is ACCEL_GRID.
+    void Render(const RenderSettings& settings, int numSpheres, const UniformGrid& grid, GLuint image, GLuint data)
+    {
+        this->setUniforms(settings, numSpheres, grid);
+        for (int i = 0; i < WF_BUFFER_COUNT; i++)
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, this->buffers[i]);
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, this->buffers[WF_DISPATCH]);
+        GLuint groups = (this->pixels + WAVEFRONT_GROUP_SIZE - 1) / WAVEFRONT_GROUP_SIZE;
+
+        this->generate.Use();
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // radiance() runs iterations + 1 times through its loop
+        GLuint pathQueue = this->buffers[WF_PATH_QUEUE], nextQueue = this->buffers[WF_NEXT_QUEUE];
+        for (int bounce = 0; bounce <= settings.iterations; bounce++) {
+            this->prepareQueues(true);
+            this->extend.Use();
+            glDispatchComputeIndirect(0);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            this->shade.Use();
+            glDispatchComputeIndirect(0);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+            // Secondary rays add to the shadow queue, so its size is only known after them
+            this->prepareQueues(false);
+            this->secondary.Use();
+            glDispatchComputeIndirect(3 * sizeof(GLuint));
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            this->prepareQueues(false);
+            this->shadow.Use();
+            glDispatchComputeIndirect(6 * sizeof(GLuint));
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+            // The paths that survived are traced next bounce
+            std::swap(pathQueue, nextQueue);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WF_PATH_QUEUE, pathQueue);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, WF_NEXT_QUEUE, nextQueue);
+        }
+
+        this->resolve.Use();
+        glBindImageTexture(0, image, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+        glBindImageTexture(1, data, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+        glUseProgram(0);
+    }
+
+private:
+    GLuint pixels;
+    Shader generate, extend, shade, secondary, shadow, prepare, resolve;
+    GLuint buffers[WF_BUFFER_COUNT];
+
+    // Sizes every buffer for the number of pixels.
+    // A refractive hit spawns two secondary rays and each of them at most one shadow ray per bounce.
+    void allocate()
+    {
+        GLsizeiptr sizes[WF_BUFFER_COUNT];
+        sizes[WF_DISPATCH] = 9 * sizeof(GLuint);
+        sizes[WF_PATHS] = this->pixels * WF_PATH_SIZE;
+        sizes[WF_HITS] = this->pixels * WF_HIT_SIZE;
+        sizes[WF_PATH_QUEUE] = sizes[WF_NEXT_QUEUE] = sizeof(GLuint) * (1 + this->pixels);
+        sizes[WF_SECONDARY_QUEUE] = sizeof(glm::vec4) + 2 * this->pixels * WF_SECONDARY_SIZE;
+        sizes[WF_SHADOW_QUEUE] = sizeof(glm::vec4) + 2 * this->pixels * WF_SHADOW_SIZE;
+        sizes[WF_CONTRIBUTIONS] = 3 * this->pixels * sizeof(glm::vec4);
+        sizes[WF_RAY_COUNTS] = 4 * this->pixels * sizeof(GLuint);
+        for (int i = 0; i < WF_BUFFER_COUNT; i++) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->buffers[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizes[i], NULL, GL_DYNAMIC_COPY);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Writes the indirect dispatch sizes of every queue, clear also empties the queues the next kernels fill
+    void prepareQueues(bool clear)
+    {
+        this->prepare.Use();
+        glUniform1i(glGetUniformLocation(this->prepare.Program, "clear_next"), clear);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+    }
+
+    // Every kernel includes trace.glsl, so all of them get the scene uniforms. Unused ones have location -1 and are ignored.
+    void setUniforms(const RenderSettings& settings, int numSpheres, const UniformGrid& grid)
+    {
+        Shader* programs[] = {&this->generate, &this->extend, &this->shade, &this->secondary, &this->shadow, &this->prepare, &this->resolve};
+        for (int i = 0; i < 7; i++) {
+            GLuint program = programs[i]->Program;
+            programs[i]->Use();
+            glUniform1i(glGetUniformLocation(program, "pixels"), this->pixels);
+            glUniform1i(glGetUniformLocation(program, "num_spheres"), numSpheres);
+            glUniform3f(glGetUniformLocation(program, "light_direction"), settings.lightDirection.x, settings.lightDirection.y, settings.lightDirection.z);
+            glUniform1i(glGetUniformLocation(program, "withPlane"), settings.withPlane);
+            glUniform1i(glGetUniformLocation(program, "canRefract"), settings.canRefract);
+            glUniform1i(glGetUniformLocation(program, "accel"), settings.accel);
+            glUniform3f(glGetUniformLocation(program, "resolution"), settings.width, settings.height, 0);
+            glUniform3f(glGetUniformLocation(program, "viewPos"), settings.viewPos.x, settings.viewPos.y, settings.viewPos.z);
+            glUniformMatrix3fv(glGetUniformLocation(program, "rot"), 1, GL_FALSE, glm::value_ptr(settings.rot));
+            if (settings.accel == ACCEL_GRID)
+                grid.SetUniforms(program);
+        }
+    }
+};